@@ -141,6 +141,21 @@ LUA_API lua_CFunction lua_atpanic (lua_State *L, lua_CFunction panicf) {
 }
 
 
+/*
+** Register 'nextf' as the primitive 'next' function. It must behave as
+** a raw 'lua_next' over its table argument; generic 'for' loops over it
+** then traverse tables without calling it.
+*/
+LUA_API lua_CFunction lua_setnextfunc (lua_State *L, lua_CFunction nextf) {
+  lua_CFunction old;
+  lua_lock(L);
+  old = G(L)->nextf;
+  G(L)->nextf = nextf;
+  lua_unlock(L);
+  return old;
+}
+
+
 LUA_API const lua_Number *lua_version (lua_State *L) {
   static const lua_Number version = LUA_VERSION_NUM;
   if (L == NULL) return &version;
@@ -342,6 +357,19 @@ LUA_API size_t lua_stringtonumber (lua_State *L, const char *s) {
 }
 
 
+/*
+** Write the number at 'idx' into 'buff' as 'tostring' would, without
+** creating a string. Return the size of the result, counting its final
+** '\0', or 0 if the value is not a number.
+*/
+LUA_API unsigned lua_numbertocstring (lua_State *L, int idx, char *buff) {
+  const TValue *o = index2addr(L, idx);
+  if (ttisnumber(o))
+    return cast(unsigned, luaO_tostringbuff(o, buff)) + 1;
+  return 0;
+}
+
+
 LUA_API lua_Number lua_tonumberx (lua_State *L, int idx, int *pisnum) {
   lua_Number n;
   const TValue *o = index2addr(L, idx);
@@ -383,6 +411,26 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
     o = index2addr(L, idx);  /* previous call may reallocate the stack */
     lua_unlock(L);
   }
+  else if (isslice(tsvalue(o))) {
+    lua_lock(L);
+    luaS_checkcstr(L, tsvalue(o));  /* C strings end with a '\0' */
+    lua_unlock(L);
+  }
+  if (len != NULL)
+    *len = vslen(o);
+  return svalue(o);
+}
+
+
+/*
+** Like 'lua_tolstring', but the bytes of a string need not be followed
+** by a '\0', so that a slice is used in place instead of getting a
+** copy of its own.
+*/
+LUA_API const char *lua_tobytes (lua_State *L, int idx, size_t *len) {
+  StkId o = index2addr(L, idx);
+  if (!ttisstring(o))
+    return lua_tolstring(L, idx, len);  /* convert it */
   if (len != NULL)
     *len = vslen(o);
   return svalue(o);
@@ -488,6 +536,63 @@ LUA_API const char *lua_pushlstring (lua_State *L, const char *s, size_t len) {
 }
 
 
+/*
+** Push the 'len' bytes of the string at 'idx' starting at offset 'i'.
+** A long result may share the memory of the original string.
+*/
+LUA_API void lua_pushsubstring (lua_State *L, int idx, size_t i, size_t len) {
+  StkId o;
+  TString *ts;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttisstring(o), "string expected");
+  api_check(L, i <= vslen(o) && len <= vslen(o) - i, "invalid substring");
+  ts = luaS_newslice(L, tsvalue(o), i, len);
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
+/*
+** Push a string whose 'len' bytes at 's' (followed by a '\0') are kept
+** by the program; Lua uses them without a copy and releases them with
+** 'falloc(ud, s, len + 1, 0)' when done (if 'falloc' is not NULL).
+** On a memory error they are not released.
+*/
+LUA_API const char *lua_pushexternalstring (lua_State *L, const char *s,
+                                 size_t len, lua_Alloc falloc, void *ud) {
+  TString *ts;
+  lua_lock(L);
+  api_check(L, s[len] == '\0', "string not ending with zero");
+  ts = luaS_newextlstr(L, s, len, falloc, ud);
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return getstr(ts);
+}
+
+
+/*
+** Push a string made of the 'len' bytes at 's' (followed by a '\0'),
+** a block of 'len + 1' bytes from 'lua_realloc' that the string takes
+** over: Lua frees it when done. On a memory error it is not taken.
+*/
+LUA_API const char *lua_pushownedstring (lua_State *L, char *s, size_t len) {
+  TString *ts;
+  lua_lock(L);
+  api_check(L, s[len] == '\0', "string not ending with zero");
+  ts = luaS_newownedlstr(L, s, len);
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return getstr(ts);
+}
+
+
 LUA_API const char *lua_pushstring (lua_State *L, const char *s) {
   lua_lock(L);
   if (s == NULL)
@@ -505,6 +610,38 @@ LUA_API const char *lua_pushstring (lua_State *L, const char *s) {
 }
 
 
+/*
+** Intern string 's' once and for all: the handle can replace 's' in
+** 'lua_getkey', 'lua_setkey' and 'lua_pushkey', which need neither the
+** string cache nor hashing. Interned keys are anchored in the registry
+** and live as long as the state.
+*/
+LUA_API lua_Key lua_internkey (lua_State *L, const char *s) {
+  Table *keys;
+  TValue *slot;
+  TString *ts;
+  lua_lock(L);
+  keys = hvalue(luaH_getint(hvalue(&G(L)->l_registry), LUA_RIDX_KEYS));
+  ts = luaS_new(L, s);
+  setsvalue2s(L, L->top, ts);  /* anchor it while it is inserted */
+  api_incr_top(L);
+  slot = luaH_set(L, keys, L->top - 1);
+  setbvalue(slot, 1);  /* keys[ts] = true */
+  luaC_barrierback(L, keys, L->top - 1);
+  L->top--;
+  lua_unlock(L);
+  return cast(lua_Key, ts);
+}
+
+
+LUA_API void lua_pushkey (lua_State *L, lua_Key k) {
+  lua_lock(L);
+  setsvalue2s(L, L->top, cast(TString *, k));
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
 LUA_API const char *lua_pushvfstring (lua_State *L, const char *fmt,
                                       va_list argp) {
   const char *ret;
@@ -590,9 +727,8 @@ LUA_API int lua_pushthread (lua_State *L) {
 */
 
 
-static int auxgetstr (lua_State *L, const TValue *t, const char *k) {
+static int auxgetstr (lua_State *L, const TValue *t, TString *str) {
   const TValue *slot;
-  TString *str = luaS_new(L, k);
   if (luaV_fastget(L, t, str, slot, luaH_getstr)) {
     setobj2s(L, L->top, slot);
     api_incr_top(L);
@@ -610,7 +746,7 @@ static int auxgetstr (lua_State *L, const TValue *t, const char *k) {
 LUA_API int lua_getglobal (lua_State *L, const char *name) {
   Table *reg = hvalue(&G(L)->l_registry);
   lua_lock(L);
-  return auxgetstr(L, luaH_getint(reg, LUA_RIDX_GLOBALS), name);
+  return auxgetstr(L, luaH_getint(reg, LUA_RIDX_GLOBALS), luaS_new(L, name));
 }
 
 
@@ -626,7 +762,13 @@ LUA_API int lua_gettable (lua_State *L, int idx) {
 
 LUA_API int lua_getfield (lua_State *L, int idx, const char *k) {
   lua_lock(L);
-  return auxgetstr(L, index2addr(L, idx), k);
+  return auxgetstr(L, index2addr(L, idx), luaS_new(L, k));
+}
+
+
+LUA_API int lua_getkey (lua_State *L, int idx, lua_Key k) {
+  lua_lock(L);
+  return auxgetstr(L, index2addr(L, idx), cast(TString *, k));
 }
 
 
@@ -745,9 +887,8 @@ LUA_API int lua_getuservalue (lua_State *L, int idx) {
 /*
 ** t[k] = value at the top of the stack (where 'k' is a string)
 */
-static void auxsetstr (lua_State *L, const TValue *t, const char *k) {
+static void auxsetstr (lua_State *L, const TValue *t, TString *str) {
   const TValue *slot;
-  TString *str = luaS_new(L, k);
   api_checknelems(L, 1);
   if (luaV_fastset(L, t, str, slot, luaH_getstr, L->top - 1))
     L->top--;  /* pop value */
@@ -764,7 +905,7 @@ static void auxsetstr (lua_State *L, const TValue *t, const char *k) {
 LUA_API void lua_setglobal (lua_State *L, const char *name) {
   Table *reg = hvalue(&G(L)->l_registry);
   lua_lock(L);  /* unlock done in 'auxsetstr' */
-  auxsetstr(L, luaH_getint(reg, LUA_RIDX_GLOBALS), name);
+  auxsetstr(L, luaH_getint(reg, LUA_RIDX_GLOBALS), luaS_new(L, name));
 }
 
 
@@ -781,7 +922,13 @@ LUA_API void lua_settable (lua_State *L, int idx) {
 
 LUA_API void lua_setfield (lua_State *L, int idx, const char *k) {
   lua_lock(L);  /* unlock done in 'auxsetstr' */
-  auxsetstr(L, index2addr(L, idx), k);
+  auxsetstr(L, index2addr(L, idx), luaS_new(L, k));
+}
+
+
+LUA_API void lua_setkey (lua_State *L, int idx, lua_Key k) {
+  lua_lock(L);  /* unlock done in 'auxsetstr' */
+  auxsetstr(L, index2addr(L, idx), cast(TString *, k));
 }
 
 
@@ -810,6 +957,7 @@ LUA_API void lua_rawset (lua_State *L, int idx) {
   api_checknelems(L, 2);
   o = index2addr(L, idx);
   api_check(L, ttistable(o), "table expected");
+  luaH_checkfrozen(L, hvalue(o));
   slot = luaH_set(L, hvalue(o), L->top - 2);
   setobj2t(L, slot, L->top - 1);
   invalidateTMcache(hvalue(o));
@@ -825,6 +973,7 @@ LUA_API void lua_rawseti (lua_State *L, int idx, lua_Integer n) {
   api_checknelems(L, 1);
   o = index2addr(L, idx);
   api_check(L, ttistable(o), "table expected");
+  luaH_checkfrozen(L, hvalue(o));
   luaH_setint(L, hvalue(o), n, L->top - 1);
   luaC_barrierback(L, hvalue(o), L->top-1);
   L->top--;
@@ -839,6 +988,7 @@ LUA_API void lua_rawsetp (lua_State *L, int idx, const void *p) {
   api_checknelems(L, 1);
   o = index2addr(L, idx);
   api_check(L, ttistable(o), "table expected");
+  luaH_checkfrozen(L, hvalue(o));
   setpvalue(&k, cast(void *, p));
   slot = luaH_set(L, hvalue(o), &k);
   setobj2t(L, slot, L->top - 1);
@@ -862,6 +1012,7 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   }
   switch (ttnov(obj)) {
     case LUA_TTABLE: {
+      luaH_checkfrozen(L, hvalue(obj));
       hvalue(obj)->metatable = mt;
       if (mt) {
         luaC_objbarrier(L, gcvalue(obj), mt);
@@ -1033,6 +1184,19 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
 }
 
 
+/*
+** Write a snapshot of the heap (see 'luaC_heapdump'). The writer must
+** not call Lua.
+*/
+LUA_API int lua_heapdump (lua_State *L, lua_Writer writer, void *data) {
+  int status;
+  lua_lock(L);
+  status = luaC_heapdump(L, writer, data);
+  lua_unlock(L);
+  return status;
+}
+
+
 LUA_API int lua_status (lua_State *L) {
   return L->status;
 }
@@ -1084,7 +1248,8 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         luaC_checkGC(L);
       }
       g->gcrunning = oldrunning;  /* restore previous state */
-      if (debt > 0 && g->gcstate == GCSpause)  /* end of cycle? */
+      /* end of cycle? (in generational mode, each step is a cycle) */
+      if (debt > 0 && (g->gcstate == GCSpause || g->gckind == KGC_GEN))
         res = 1;  /* signal it */
       break;
     }
@@ -1103,6 +1268,54 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCGEN: {
+      res = (g->gckind == KGC_GEN) ? LUA_GCGEN : LUA_GCINC;  /* old mode */
+      if (data != 0)
+        g->genminormul = data;
+      luaC_changemode(L, KGC_GEN);
+      break;
+    }
+    case LUA_GCINC: {
+      res = (g->gckind == KGC_GEN) ? LUA_GCGEN : LUA_GCINC;  /* old mode */
+      luaC_changemode(L, KGC_INC);
+      break;
+    }
+    case LUA_GCWORKERS: {
+      res = luaC_setworkers(L, data);  /* previous number of workers */
+      break;
+    }
+    case LUA_GCSWEEPER: {
+      res = luaC_setsweeper(L, data);  /* previous state */
+      break;
+    }
+    case LUA_GCSETMAXPAUSE: {  /* in microseconds; 0 turns pacer off */
+      res = cast_int(g->gcmaxpause);
+      g->gcmaxpause = (data > 0) ? cast(unsigned int, data) : 0;
+      break;
+    }
+    case LUA_GCSETOVERHEAD: {
+      res = g->gcoverhead;
+      if (data < 10) data = 10;  /* avoid collecting all the time */
+      g->gcoverhead = data;
+      break;
+    }
+    case LUA_GCPACERMUL: {  /* multiplier the pacer arrived at */
+      res = g->gcpacemul;
+      if (data > 0)
+        g->gcpacemul = data;
+      break;
+    }
+    case LUA_GCSOFTLIMIT: case LUA_GCHARDLIMIT: {  /* limits in Kbytes */
+      lu_mem *limit = (what == LUA_GCSOFTLIMIT) ? &g->memsoft : &g->memhard;
+      res = cast_int(*limit >> 10);
+      if (data >= 0) {
+        *limit = cast(lu_mem, data) << 10;
+        if (what == LUA_GCSOFTLIMIT)
+          g->memsoftfired = 0;
+        luaM_setlimits(g);
+      }
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1158,6 +1371,73 @@ LUA_API void lua_concat (lua_State *L, int n) {
 }
 
 
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId t;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, ttistable(t), "table expected");
+  luaH_checkfrozen(L, hvalue(t));
+  luaH_clear(hvalue(t));
+  lua_unlock(L);
+}
+
+
+LUA_API int lua_freezetable (lua_State *L, int idx) {
+  StkId t;
+  int res;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, ttistable(t), "table expected");
+  res = luaC_freeze(L, hvalue(t));
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API int lua_isfrozen (lua_State *L, int idx) {
+  StkId t = index2addr(L, idx);
+  return (ttistable(t) && isfrozen(hvalue(t)));
+}
+
+
+/*
+** Move elements 'a1[f], ..., a1[e]' into 'a2[t], a2[t+1], ...' with a
+** single copy, when both ranges lie in the array parts of the tables,
+** 'a1' has no '__index' and 'a2' has no '__newindex' metamethod (so
+** that the result is the same as moving them one by one with
+** 'lua_geti'/'lua_seti'). Returns 0, doing nothing, when these
+** conditions do not hold.
+*/
+LUA_API int lua_arraymove (lua_State *L, int a1, lua_Integer f,
+                           lua_Integer e, lua_Integer t, int a2) {
+  StkId o1, o2;
+  Table *h1, *h2;
+  int res = 0;
+  lua_lock(L);
+  o1 = index2addr(L, a1);
+  o2 = index2addr(L, a2);
+  if (ttistable(o1) && ttistable(o2)) {
+    h1 = hvalue(o1);
+    h2 = hvalue(o2);
+    /* check the source range before computing its size (no overflows) */
+    if (1 <= f && f <= e && e <= cast(lua_Integer, h1->sizearray)) {
+      lua_Integer n = e - f + 1;  /* number of elements to move */
+      if (1 <= t && t - 1 <= cast(lua_Integer, h2->sizearray) - n &&
+          fasttm(L, h1->metatable, TM_INDEX) == NULL &&
+          fasttm(L, h2->metatable, TM_NEWINDEX) == NULL && !isfrozen(h2)) {
+        memmove(&h2->array[t - 1], &h1->array[f - 1],
+                cast(size_t, n) * sizeof(TValue));
+        if (isblack(h2))  /* moved values may be white */
+          luaC_barrierback_(L, h2);
+        res = 1;
+      }
+    }
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
 LUA_API void lua_len (lua_State *L, int idx) {
   StkId t;
   lua_lock(L);
@@ -1180,12 +1460,121 @@ LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
 
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  luaC_drainsweeper(G(L));  /* blocks freed so far go to the old allocator */
   G(L)->ud = ud;
   G(L)->frealloc = f;
   lua_unlock(L);
 }
 
 
+/*
+** Resize a block as the allocation function does, but as the state's
+** own memory: it counts for the collector and the memory limits, is
+** seen by the allocation profiler, and a failure raises a memory
+** error.
+*/
+LUA_API void *lua_realloc (lua_State *L, void *block, size_t osize,
+                           size_t nsize) {
+  void *res;
+  lua_lock(L);
+  res = luaM_realloc_(L, block, osize, nsize);
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API void lua_gcstats (lua_State *L, lua_GCStats *stats) {
+  lua_lock(L);
+  *stats = G(L)->gclaststats;
+  lua_unlock(L);
+}
+
+
+LUA_API lua_GCHook lua_getgchook (lua_State *L, void **ud) {
+  lua_GCHook f;
+  lua_lock(L);
+  if (ud) *ud = G(L)->gchookud;
+  f = G(L)->gchook;
+  lua_unlock(L);
+  return f;
+}
+
+
+LUA_API void lua_setgchook (lua_State *L, lua_GCHook f, void *ud) {
+  lua_lock(L);
+  G(L)->gchookud = ud;
+  G(L)->gchook = f;
+  lua_unlock(L);
+}
+
+
+LUA_API lua_MemHook lua_getmemhook (lua_State *L, void **ud) {
+  lua_MemHook f;
+  lua_lock(L);
+  if (ud) *ud = G(L)->memhookud;
+  f = G(L)->memhook;
+  lua_unlock(L);
+  return f;
+}
+
+
+LUA_API void lua_setmemhook (lua_State *L, lua_MemHook f, void *ud) {
+  lua_lock(L);
+  G(L)->memhookud = ud;
+  G(L)->memhook = f;
+  lua_unlock(L);
+}
+
+
+LUA_API int lua_strcache (lua_State *L, int nsets, size_t *hits,
+                                                   size_t *misses) {
+  global_State *g;
+  int res;
+  lua_lock(L);
+  g = G(L);
+  if (nsets > 0) {
+    int n = 1;
+    api_check(L, nsets <= MAX_INT / (2 * STRCACHE_M), "cache too large");
+    while (n < nsets) n *= 2;
+    luaS_resizecache(L, n);
+  }
+  if (hits) *hits = cast(size_t, g->strcachehits);
+  if (misses) *misses = cast(size_t, g->strcachemisses);
+  res = g->strcachesize;
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API int lua_internlen (lua_State *L, int len) {
+  global_State *g;
+  int res;
+  lua_lock(L);
+  g = G(L);
+  res = cast_int(g->internlen);
+  if (len >= 0) {  /* set a new length? */
+    if (len > LUAI_MAXINTERNLEN)
+      len = LUAI_MAXINTERNLEN;  /* buffers for medium strings have this size */
+    else if (len < LUAI_MAXSHORTLEN)
+      len = LUAI_MAXSHORTLEN;
+    g->internlen = cast(size_t, len);
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API int lua_bytecollate (lua_State *L, int bytes) {
+  int res;
+  lua_lock(L);
+  res = G(L)->bytecollate;
+  if (bytes >= 0)
+    G(L)->bytecollate = (bytes != 0);
+  lua_unlock(L);
+  return res;
+}
+
+
 LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
   Udata *u;
   lua_lock(L);
@@ -1298,6 +1687,7 @@ LUA_API void lua_upvaluejoin (lua_State *L, int fidx1, int n1,
   *up1 = *up2;
   (*up1)->refcount++;
   if (upisopen(*up1)) (*up1)->u.open.touched = 1;
+  (*up1)->old = 1;  /* 'f1' may be old */
   luaC_upvalbarrier(L, *up1);
 }
 
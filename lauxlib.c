@@ -11,6 +11,7 @@
 
 
 #include <errno.h>
+#include <locale.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -558,7 +559,15 @@ LUALIB_API void luaL_pushresultsize (luaL_Buffer *B, size_t sz) {
 LUALIB_API void luaL_addvalue (luaL_Buffer *B) {
   lua_State *L = B->L;
   size_t l;
-  const char *s = lua_tolstring(L, -1, &l);
+  const char *s;
+  if (lua_type(L, -1) == LUA_TNUMBER) {  /* no need to make a string */
+    char buff[LUA_N2SBUFFSZ];
+    l = lua_numbertocstring(L, -1, buff) - 1;
+    lua_pop(L, 1);  /* remove number; buffer (if any) is now on top */
+    luaL_addlstring(B, buff, l);
+    return;
+  }
+  s = lua_tobytes(L, -1, &l);  /* a slice needs no copy of its own */
   if (buffonstack(B))
     lua_insert(L, -2);  /* put value below buffer */
   luaL_addlstring(B, s, l);
@@ -988,6 +997,18 @@ LUALIB_API void luaL_requiref (lua_State *L, const char *modname,
 }
 
 
+/*
+** Make strings in 'L' order by bytes when the current collation locale
+** is "C" (or "POSIX"), where 'strcoll' compares bytes anyway; the
+** standard libraries call it when they open and after 'os.setlocale'.
+*/
+LUALIB_API void luaL_setcollate (lua_State *L) {
+  const char *name = setlocale(LC_COLLATE, NULL);
+  lua_bytecollate(L, name != NULL &&
+                     (strcmp(name, "C") == 0 || strcmp(name, "POSIX") == 0));
+}
+
+
 LUALIB_API const char *luaL_gsub (lua_State *L, const char *s, const char *p,
                                                                const char *r) {
   const char *wild;
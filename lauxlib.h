@@ -106,6 +106,8 @@ LUALIB_API void (luaL_traceback) (lua_State *L, lua_State *L1,
 LUALIB_API void (luaL_requiref) (lua_State *L, const char *modname,
                                  lua_CFunction openf, int glb);
 
+LUALIB_API void (luaL_setcollate) (lua_State *L);
+
 /*
 ** ===============================================================
 ** some useful macros
@@ -199,6 +201,30 @@ typedef struct luaL_Stream {
 
 
 
+/*
+** {======================================================
+** Buffers of the buffer library
+** =======================================================
+*/
+
+/*
+** A buffer is a userdata with metatable 'LUA_BUFFERHANDLE' and
+** structure 'luaL_Membuf'. Its block comes from 'lua_realloc'.
+*/
+
+#define LUA_BUFFERHANDLE	"BUFFER*"
+
+
+typedef struct luaL_Membuf {
+  char *b;  /* block with the contents (NULL when there is none) */
+  size_t n;  /* number of bytes in use */
+  size_t size;  /* size of the block */
+} luaL_Membuf;
+
+/* }====================================================== */
+
+
+
 /* compatibility with old module system */
 #if defined(LUA_COMPAT_MODULE)
 
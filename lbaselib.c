@@ -170,26 +170,89 @@ static int luaB_rawset (lua_State *L) {
 }
 
 
+/* pseudo-option of 'collectgarbage' served by 'lua_gcstats' */
+#define GCSTATS		(-1)
+
+
+static void setcounts (lua_State *L, const char *field, const size_t *c) {
+  static const int types[] = {LUA_TSTRING, LUA_TTABLE, LUA_TFUNCTION,
+    LUA_TUSERDATA, LUA_TTHREAD, LUA_GCTPROTO};
+  int i;
+  lua_createtable(L, 0, 6);
+  for (i = 0; i < 6; i++) {
+    int t = types[i];
+    lua_pushinteger(L, (lua_Integer)c[t]);
+    lua_setfield(L, -2, (t == LUA_GCTPROTO) ? "proto" : lua_typename(L, t));
+  }
+  lua_setfield(L, -2, field);
+}
+
+
+/*
+** Statistics of the last complete cycle; times are in microseconds.
+*/
+static int pushgcstats (lua_State *L) {
+  static const char *const phases[LUA_GCNPHASES] = {"propagate", "atomic",
+    "sweepallgc", "sweepfinobj", "sweeptobefnz", "sweepend", "callfin",
+    "pause"};
+  lua_GCStats st;
+  int i;
+  lua_gcstats(L, &st);
+  lua_createtable(L, 0, 9);
+  lua_pushinteger(L, (lua_Integer)st.cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushinteger(L, (lua_Integer)st.steps);
+  lua_setfield(L, -2, "steps");
+  lua_pushinteger(L, (lua_Integer)st.maxstep);
+  lua_setfield(L, -2, "maxstep");
+  lua_pushinteger(L, (lua_Integer)st.finalizers);
+  lua_setfield(L, -2, "finalizers");
+  lua_pushinteger(L, (lua_Integer)st.freedbytes);
+  lua_setfield(L, -2, "freedbytes");
+  lua_createtable(L, 0, LUA_GCNPHASES);
+  for (i = 0; i < LUA_GCNPHASES; i++) {
+    lua_pushinteger(L, (lua_Integer)st.time[i]);
+    lua_setfield(L, -2, phases[i]);
+  }
+  lua_setfield(L, -2, "time");
+  setcounts(L, "marked", st.marked);
+  setcounts(L, "freed", st.freed);
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", NULL};
+    "isrunning", "generational", "incremental", "workers",
+    "sweeper", "setmaxpause", "setoverhead", "pacermul", "stats",
+    "softlimit", "hardlimit", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, LUA_GCWORKERS,
+    LUA_GCSWEEPER, LUA_GCSETMAXPAUSE, LUA_GCSETOVERHEAD, LUA_GCPACERMUL,
+    GCSTATS, LUA_GCSOFTLIMIT, LUA_GCHARDLIMIT};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
-  int ex = (int)luaL_optinteger(L, 2, 0);
-  int res = lua_gc(L, o, ex);
+  int query = (o == LUA_GCSOFTLIMIT || o == LUA_GCHARDLIMIT);
+  int ex = (int)luaL_optinteger(L, 2, query ? -1 : 0);  /* -1: no change */
+  int res;
+  if (o == GCSTATS)
+    return pushgcstats(L);
+  res = lua_gc(L, o, ex);
   switch (o) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
       lua_pushnumber(L, (lua_Number)res + ((lua_Number)b/1024));
       return 1;
     }
-    case LUA_GCSTEP: case LUA_GCISRUNNING: {
+    case LUA_GCSTEP: case LUA_GCISRUNNING: case LUA_GCSWEEPER: {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCGEN: case LUA_GCINC: {
+      lua_pushstring(L, (res == LUA_GCGEN) ? "generational" : "incremental");
+      return 1;
+    }
     default: {
       lua_pushinteger(L, res);
       return 1;
@@ -489,6 +552,7 @@ LUAMOD_API int luaopen_base (lua_State *L) {
   /* open lib into global table */
   lua_pushglobaltable(L);
   luaL_setfuncs(L, base_funcs, 0);  // 把数组 base_funcs 中的所有函数 （参见 luaL_Reg） 注册到栈顶的表中
+  lua_setnextfunc(L, luaB_next);  /* let 'for' loops traverse by slot */
   /* set global _G */
   lua_pushvalue(L, -1);
   lua_setfield(L, -2, "_G");
@@ -0,0 +1,244 @@
+/*
+** $Id: lbuflib.c $
+** Standard library for mutable string buffers
+** See Copyright Notice in lua.h
+*/
+
+#define lbuflib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** A buffer is a userdata 'luaL_Membuf' with metatable LUA_BUFFERHANDLE
+** (see lauxlib.h). Its contents live in a block from 'lua_realloc',
+** so they count as memory of the state, released by '__gc'; unlike
+** the box of a 'luaL_Buffer', the buffer is a value of its own, not
+** tied to the stack of a C function.
+*/
+
+#define tobuffer(L)	((luaL_Membuf *)luaL_checkudata(L, 1, LUA_BUFFERHANDLE))
+
+#define testbuffer(L,i)	((luaL_Membuf *)luaL_testudata(L, i, LUA_BUFFERHANDLE))
+
+
+/* initial size of a buffer block */
+#define MINBUFSIZE	32
+
+
+static void resizebuf (lua_State *L, luaL_Membuf *mb, size_t newsize) {
+  mb->b = (char *)lua_realloc(L, mb->b, mb->size, newsize);
+  mb->size = newsize;
+}
+
+
+/*
+** returns a pointer to a free area with at least 'sz' bytes (plus one
+** for the '\0' that 'take' adds)
+*/
+static char *prepbuf (lua_State *L, luaL_Membuf *mb, size_t sz) {
+  if (mb->size - mb->n <= sz) {  /* not enough space? */
+    size_t newsize = mb->size * 2;  /* double buffer size */
+    if (newsize < MINBUFSIZE)
+      newsize = MINBUFSIZE;
+    if (newsize - mb->n <= sz)  /* not big enough? */
+      newsize = mb->n + sz + 1;
+    if (newsize <= mb->n || newsize - mb->n <= sz)
+      luaL_error(L, "buffer too large");
+    resizebuf(L, mb, newsize);
+  }
+  return mb->b + mb->n;
+}
+
+
+static void addbuf (lua_State *L, luaL_Membuf *mb, const char *s, size_t l) {
+  if (l > 0) {  /* avoid 'memcpy' when 's' can be NULL */
+    memcpy(prepbuf(L, mb, l), s, l * sizeof(char));
+    mb->n += l;
+  }
+}
+
+
+static luaL_Membuf *newbuffer (lua_State *L) {
+  luaL_Membuf *mb = (luaL_Membuf *)lua_newuserdata(L, sizeof(luaL_Membuf));
+  mb->b = NULL;  /* no block yet */
+  mb->n = mb->size = 0;
+  luaL_setmetatable(L, LUA_BUFFERHANDLE);
+  return mb;
+}
+
+
+static int buf_new (lua_State *L) {
+  lua_Integer sz = luaL_optinteger(L, 1, 0);
+  luaL_Membuf *mb;
+  luaL_argcheck(L, sz >= 0, 1, "invalid size");
+  mb = newbuffer(L);
+  if (sz > 0)
+    prepbuf(L, mb, (size_t)sz);
+  return 1;
+}
+
+
+static int buf_isbuffer (lua_State *L) {
+  luaL_checkany(L, 1);
+  lua_pushboolean(L, testbuffer(L, 1) != NULL);
+  return 1;
+}
+
+
+/*
+** Append strings, numbers and buffers (including the buffer itself,
+** whose block may move while growing).
+*/
+static int buf_append (lua_State *L) {
+  luaL_Membuf *mb = tobuffer(L);
+  int i, n = lua_gettop(L);
+  for (i = 2; i <= n; i++) {
+    luaL_Membuf *other = testbuffer(L, i);
+    if (other == mb) {
+      size_t l = mb->n;
+      if (l > 0) {
+        prepbuf(L, mb, l);
+        memcpy(mb->b + l, mb->b, l * sizeof(char));
+        mb->n += l;
+      }
+    }
+    else if (other != NULL)
+      addbuf(L, mb, other->b, other->n);
+    else if (lua_type(L, i) == LUA_TNUMBER) {
+      char nbuff[LUA_N2SBUFFSZ];
+      unsigned sz = lua_numbertocstring(L, i, nbuff);
+      addbuf(L, mb, nbuff, sz - 1);
+    }
+    else if (lua_isstring(L, i)) {
+      size_t l;
+      const char *s = lua_tobytes(L, i, &l);
+      addbuf(L, mb, s, l);
+    }
+    else
+      return luaL_argerror(L, i, lua_pushfstring(L,
+                 "string, number or buffer expected, got %s",
+                 luaL_typename(L, i)));
+  }
+  lua_settop(L, 1);
+  return 1;  /* return the buffer */
+}
+
+
+/*
+** Append the result of 'string.format' (first upvalue) with the given
+** arguments.
+*/
+static int buf_format (lua_State *L) {
+  luaL_Membuf *mb = tobuffer(L);
+  int n = lua_gettop(L);
+  size_t l;
+  const char *s;
+  luaL_checkstring(L, 2);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_rotate(L, 2, 1);  /* put 'format' below its arguments */
+  lua_call(L, n - 1, 1);
+  s = lua_tobytes(L, -1, &l);
+  addbuf(L, mb, s, l);
+  lua_settop(L, 1);
+  return 1;  /* return the buffer */
+}
+
+
+/* empty the buffer, keeping its block for reuse */
+static int buf_reset (lua_State *L) {
+  tobuffer(L)->n = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)tobuffer(L)->n);
+  return 1;
+}
+
+
+static int buf_tostring (lua_State *L) {
+  luaL_Membuf *mb = tobuffer(L);
+  lua_pushlstring(L, mb->b, mb->n);
+  return 1;
+}
+
+
+/*
+** Return the contents and empty the buffer. The block itself becomes
+** the string (see 'lua_pushownedstring'), so nothing is copied; the
+** buffer gets a new block when it is used again.
+*/
+static int buf_take (lua_State *L) {
+  luaL_Membuf *mb = tobuffer(L);
+  if (mb->n == 0)
+    lua_pushliteral(L, "");
+  else {
+    if (mb->size != mb->n + 1)
+      resizebuf(L, mb, mb->n + 1);  /* fit the block to the string */
+    mb->b[mb->n] = '\0';
+    lua_pushownedstring(L, mb->b, mb->n);
+    mb->b = NULL;  /* block now belongs to the string */
+    mb->size = 0;
+  }
+  mb->n = 0;
+  return 1;
+}
+
+
+static int buf_gc (lua_State *L) {
+  luaL_Membuf *mb = tobuffer(L);
+  resizebuf(L, mb, 0);
+  mb->n = 0;
+  return 0;
+}
+
+
+static const luaL_Reg buflib[] = {
+  {"new", buf_new},
+  {"isbuffer", buf_isbuffer},
+  {NULL, NULL}
+};
+
+
+/*
+** methods for buffers
+*/
+static const luaL_Reg blib[] = {
+  {"append", buf_append},
+  {"format", buf_format},
+  {"reset", buf_reset},
+  {"len", buf_len},
+  {"tostring", buf_tostring},
+  {"take", buf_take},
+  {"__len", buf_len},
+  {"__tostring", buf_tostring},
+  {"__gc", buf_gc},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_buffer (lua_State *L) {
+  luaL_newlib(L, buflib);
+  luaL_newmetatable(L, LUA_BUFFERHANDLE);  /* create metatable for buffers */
+  luaL_requiref(L, LUA_STRLIBNAME, luaopen_string, 0);
+  lua_getfield(L, -1, "format");
+  lua_remove(L, -2);  /* remove string library */
+  luaL_setfuncs(L, blib, 1);  /* add methods, sharing 'format' */
+  lua_pushvalue(L, -1);  /* push metatable */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  lua_pop(L, 1);  /* pop metatable */
+  return 1;
+}
+
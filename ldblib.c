@@ -428,6 +428,279 @@ static int db_traceback (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Allocation profiler
+** =======================================================
+*/
+
+/*
+** Start sampling allocations about every 'kb' kilobytes (0 stops the
+** profiler and discards its data); returns the previous interval.
+*/
+static int db_allocprofile (lua_State *L) {
+  lua_Integer kb = luaL_optinteger(L, 1, 0);
+  luaL_argcheck(L, kb >= 0, 1, "negative interval");
+  lua_pushinteger(L,
+      (lua_Integer)(lua_allocprofile(L, (size_t)kb * 1024) / 1024));
+  return 1;
+}
+
+
+static void sitetotable (lua_State *L, const char *stack, size_t bytes,
+                         size_t samples, void *ud) {
+  (void)samples; (void)ud;
+  lua_pushinteger(L, (lua_Integer)bytes);
+  lua_setfield(L, -2, stack);
+}
+
+
+static void sitetofolded (lua_State *L, const char *stack, size_t bytes,
+                          size_t samples, void *ud) {
+  luaL_Buffer *b = (luaL_Buffer *)ud;
+  (void)samples;
+  luaL_addstring(b, stack);
+  lua_pushfstring(L, " %I\n", (lua_Integer)bytes);
+  luaL_addvalue(b);
+}
+
+
+/*
+** Bytes allocated by each sampled stack: a table indexed by stacks or,
+** if 'folded' is true, a string in the folded format of flame graphs.
+*/
+static int db_allocsites (lua_State *L) {
+  if (lua_toboolean(L, 1)) {
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    lua_allocsites(L, sitetofolded, &b);
+    luaL_pushresult(&b);
+  }
+  else {
+    lua_newtable(L);
+    lua_allocsites(L, sitetotable, NULL);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Heap snapshots
+** =======================================================
+*/
+
+/* types of collectable objects, as named in a snapshot */
+static const char *const heaptypes[] = {"string", "table", "function",
+  "userdata", "thread", "proto", NULL};
+
+#define NHEAPTYPES	6
+
+#define HEAPIDSIZE	64
+
+#define HEAPFILE	"debug.heapfile"
+
+
+/*
+** A snapshot file stays in a userdata (a 'luaL_Stream', as in the io
+** library) while it is in use, so that an error cannot leak it.
+*/
+static int heapfilegc (lua_State *L) {
+  luaL_Stream *p = (luaL_Stream *)luaL_checkudata(L, 1, HEAPFILE);
+  if (p->closef != NULL) {  /* not closed yet? */
+    p->closef = NULL;
+    fclose(p->f);
+  }
+  return 0;
+}
+
+
+/*
+** Open file 'fname' and push its userdata; returns NULL (with the
+** userdata on the stack) if the file cannot be opened.
+*/
+static FILE *openheapfile (lua_State *L, const char *fname,
+                           const char *mode) {
+  luaL_Stream *p = (luaL_Stream *)lua_newuserdata(L, sizeof(luaL_Stream));
+  p->closef = NULL;  /* mark file as closed */
+  if (luaL_newmetatable(L, HEAPFILE)) {
+    lua_pushcfunction(L, heapfilegc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  p->f = fopen(fname, mode);
+  if (p->f != NULL)
+    p->closef = &heapfilegc;
+  return p->f;
+}
+
+
+/* close the file on the top of the stack and pop it */
+static int closeheapfile (lua_State *L) {
+  luaL_Stream *p = (luaL_Stream *)lua_touserdata(L, -1);
+  int ok = (fclose(p->f) == 0);
+  p->closef = NULL;
+  lua_pop(L, 1);
+  return ok;
+}
+
+
+static int heapwriter (lua_State *L, const void *p, size_t sz, void *ud) {
+  (void)L;
+  return (fwrite(p, 1, sz, (FILE *)ud) != sz);
+}
+
+
+static int db_heapdump (lua_State *L) {
+  const char *fname = luaL_checkstring(L, 1);
+  FILE *f = openheapfile(L, fname, "w");
+  int status;
+  if (f == NULL)
+    return luaL_fileresult(L, 0, fname);
+  status = lua_heapdump(L, heapwriter, f);
+  if (!closeheapfile(L))
+    status = 1;
+  return luaL_fileresult(L, (status == 0), fname);
+}
+
+
+static void skipline (FILE *f) {
+  int c;
+  while ((c = getc(f)) != EOF && c != '\n')
+    ;
+}
+
+
+/*
+** Read the next object of a snapshot, skipping roots. Returns 1 if it
+** read an object, 0 at the end of the file, -1 for a malformed line.
+*/
+static int readobject (FILE *f, char *id, int *type, size_t *size) {
+  char tname[HEAPIDSIZE];
+  unsigned long sz;
+  for (;;) {
+    int i;
+    if (fscanf(f, "%63s", id) != 1)
+      return 0;
+    if (strcmp(id, "root") == 0) {
+      skipline(f);
+      continue;
+    }
+    if (fscanf(f, "%63s %lu", tname, &sz) != 2)
+      return -1;
+    skipline(f);
+    for (i = 0; heaptypes[i] != NULL; i++) {
+      if (strcmp(tname, heaptypes[i]) == 0) {
+        *type = i;
+        *size = (size_t)sz;
+        return 1;
+      }
+    }
+    return -1;
+  }
+}
+
+
+/* open a snapshot for reading, pushing its userdata */
+static FILE *openheap (lua_State *L, const char *fname) {
+  char header[HEAPIDSIZE];
+  FILE *f = openheapfile(L, fname, "r");
+  if (f == NULL)
+    luaL_error(L, "cannot open %s", fname);
+  if (fgets(header, sizeof(header), f) == NULL ||
+      strcmp(header, "luaheap 1\n") != 0)
+    luaL_error(L, "%s is not a heap snapshot", fname);
+  return f;
+}
+
+
+static void badheap (lua_State *L, const char *fname) {
+  luaL_error(L, "malformed heap snapshot %s", fname);
+}
+
+
+static void setcount (lua_State *L, const char *k, size_t v) {
+  lua_pushinteger(L, (lua_Integer)v);
+  lua_setfield(L, -2, k);
+}
+
+
+/*
+** Compare two snapshots. For each type, returns the number and size of
+** objects in the second one, of those new in it, and of those freed
+** since the first one; the second result lists (up to 'max') objects
+** new in the second snapshot. Objects are matched by id (address), so
+** an address reused by an object of the same type is not seen as new.
+*/
+static int db_heapdiff (lua_State *L) {
+  const char *fa = luaL_checkstring(L, 1);
+  const char *fb = luaL_checkstring(L, 2);
+  lua_Integer max = luaL_optinteger(L, 3, 0);
+  lua_Integer nnew = 0;
+  size_t count[NHEAPTYPES][6];  /* count, bytes, new, newbytes, freed... */
+  char id[HEAPIDSIZE];
+  int t, res;
+  size_t size;
+  FILE *f;
+  memset(count, 0, sizeof(count));
+  lua_settop(L, 3);
+  lua_newtable(L);  /* 4: ids in first snapshot -> size and type */
+  lua_newtable(L);  /* 5: new objects */
+  f = openheap(L, fa);  /* 6: file */
+  while ((res = readobject(f, id, &t, &size)) > 0) {
+    lua_pushinteger(L, (lua_Integer)size * NHEAPTYPES + t);
+    lua_setfield(L, 4, id);
+  }
+  if (res < 0) badheap(L, fa);
+  closeheapfile(L);
+  f = openheap(L, fb);
+  while ((res = readobject(f, id, &t, &size)) > 0) {
+    count[t][0]++;
+    count[t][1] += size;
+    if (lua_getfield(L, 4, id) == LUA_TNUMBER &&
+        lua_tointeger(L, -1) % NHEAPTYPES == t) {  /* object was there? */
+      lua_pushnil(L);
+      lua_setfield(L, 4, id);  /* not freed */
+    }
+    else {
+      count[t][2]++;
+      count[t][3] += size;
+      if (nnew < max) {
+        lua_pushfstring(L, "%s %s %I", id, heaptypes[t], (lua_Integer)size);
+        lua_rawseti(L, 5, ++nnew);
+      }
+    }
+    lua_pop(L, 1);
+  }
+  if (res < 0) badheap(L, fb);
+  closeheapfile(L);
+  lua_pushnil(L);
+  while (lua_next(L, 4)) {  /* remaining objects were freed */
+    lua_Integer v = lua_tointeger(L, -1);
+    count[v % NHEAPTYPES][4]++;
+    count[v % NHEAPTYPES][5] += (size_t)(v / NHEAPTYPES);
+    lua_pop(L, 1);
+  }
+  lua_createtable(L, 0, NHEAPTYPES);
+  for (t = 0; t < NHEAPTYPES; t++) {
+    lua_createtable(L, 0, 6);
+    setcount(L, "count", count[t][0]);
+    setcount(L, "bytes", count[t][1]);
+    setcount(L, "new", count[t][2]);
+    setcount(L, "newbytes", count[t][3]);
+    setcount(L, "freed", count[t][4]);
+    setcount(L, "freedbytes", count[t][5]);
+    lua_setfield(L, -2, heaptypes[t]);
+  }
+  lua_pushvalue(L, 5);
+  return 2;
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -445,6 +718,10 @@ static const luaL_Reg dblib[] = {
   {"setmetatable", db_setmetatable},
   {"setupvalue", db_setupvalue},
   {"traceback", db_traceback},
+  {"heapdump", db_heapdump},
+  {"heapdiff", db_heapdiff},
+  {"allocprofile", db_allocprofile},
+  {"allocsites", db_allocsites},
   {NULL, NULL}
 };
 
@@ -12,6 +12,7 @@
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "lua.h"
@@ -697,3 +698,306 @@ void luaG_traceexec (lua_State *L) {
   }
 }
 
+
+/*
+** {======================================================
+** Allocation profiler
+** =======================================================
+*/
+
+/* maximum number of frames in a sample (the innermost ones are kept) */
+#if !defined(LUAI_MAXSAMPLEDEPTH)
+#define LUAI_MAXSAMPLEDEPTH	64
+#endif
+
+/* space for a folded stack */
+#define SAMPLEBUFF	(LUAI_MAXSAMPLEDEPTH * (LUA_IDSIZE + 16))
+
+/* initial size of the table of sites */
+#define MINSITES	64
+
+
+/*
+** Samples are aggregated by call stack, in the "folded" format of
+** flame-graph tools: frames from outermost to innermost, separated by
+** semicolons. Stacks are kept as text because the prototypes they
+** mention may be collected before the profile is read.
+*/
+typedef struct AllocSite {
+  struct AllocSite *next;  /* next site in hash chain */
+  unsigned int hash;
+  size_t bytes;  /* bytes allocated by this stack (estimate) */
+  size_t samples;  /* number of samples taken at this stack */
+  size_t len;  /* length of 'stack' */
+  char stack[1];  /* folded stack (variable size) */
+} AllocSite;
+
+#define sizesite(l)	(offsetof(AllocSite, stack) + (l) + 1)
+
+
+/*
+** The profile lives outside the heap of the state (its memory comes
+** straight from the allocation function), so that sampling does not
+** allocate through 'luaM_realloc_', which calls it.
+*/
+typedef struct AllocProfile {
+  size_t interval;  /* average number of bytes between samples */
+  l_mem target;  /* length of the current sampling interval */
+  unsigned int rand;  /* state of the generator jittering intervals */
+  int size;  /* size of 'hash' */
+  int nuse;  /* number of sites */
+  AllocSite **hash;
+} AllocProfile;
+
+
+/*
+** Set the countdown to the next sample. Intervals are jittered (in
+** [interval/2, 3*interval/2)) so that periodic allocation patterns are
+** not always sampled at the same point.
+*/
+static void nextsample (global_State *g, AllocProfile *ap) {
+  unsigned int r = ap->rand;  /* xorshift generator */
+  r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+  ap->rand = r;
+  ap->target = cast(l_mem, ap->interval / 2 + r % ap->interval) + 1;
+  g->allocsample = ap->target;
+}
+
+
+static size_t addtext (char *buff, size_t n, const char *s) {
+  for (; *s != '\0' && n < SAMPLEBUFF - 1; s++)
+    buff[n++] = (*s == ';') ? ',' : *s;  /* ';' separates frames */
+  return n;
+}
+
+
+static size_t addframe (lua_State *L, CallInfo *ci, char *buff, size_t n) {
+  if (isLua(ci)) {
+    Proto *p = ci_func(ci)->p;
+    char text[LUA_IDSIZE];
+    if (p->source)
+      luaO_chunkid(text, getstr(p->source), LUA_IDSIZE);
+    else
+      strcpy(text, "?");
+    n = addtext(buff, n, text);
+    lua_integer2str(text, sizeof(text), cast(LUA_INTEGER, currentline(ci)));
+    n = addtext(buff, n, ":");
+    n = addtext(buff, n, text);
+  }
+  else {
+    const char *name;
+    n = addtext(buff, n, "[C]");
+    if (getfuncname(L, ci, &name) != NULL) {
+      n = addtext(buff, n, ":");
+      n = addtext(buff, n, name);
+    }
+  }
+  return n;
+}
+
+
+/* write the folded stack of 'L' into 'buff'; returns its length */
+static size_t foldstack (lua_State *L, char *buff) {
+  CallInfo *frames[LUAI_MAXSAMPLEDEPTH];
+  CallInfo *ci;
+  size_t n = 0;
+  int i, nf = 0;
+  for (ci = L->ci; ci != &L->base_ci && nf < LUAI_MAXSAMPLEDEPTH;
+       ci = ci->previous)
+    frames[nf++] = ci;
+  if (ci != &L->base_ci)  /* stack was truncated? */
+    n = addtext(buff, n, "...");
+  for (i = nf - 1; i >= 0; i--) {
+    if (n > 0 && n < SAMPLEBUFF - 1)
+      buff[n++] = ';';
+    n = addframe(L, frames[i], buff, n);
+  }
+  if (n == 0)
+    n = addtext(buff, n, "?");  /* no frames (e.g., main chunk loading) */
+  buff[n] = '\0';
+  return n;
+}
+
+
+static void resizesites (global_State *g, AllocProfile *ap, int newsize) {
+  AllocSite **newhash = cast(AllocSite **, (*g->frealloc)(g->ud, NULL, 0,
+                                     newsize * sizeof(AllocSite *)));
+  int i;
+  if (newhash == NULL)
+    return;  /* keep old table */
+  for (i = 0; i < newsize; i++)
+    newhash[i] = NULL;
+  for (i = 0; i < ap->size; i++) {  /* rehash all sites */
+    AllocSite *s = ap->hash[i];
+    while (s != NULL) {
+      AllocSite *next = s->next;
+      int h = lmod(s->hash, newsize);
+      s->next = newhash[h];
+      newhash[h] = s;
+      s = next;
+    }
+  }
+  (*g->frealloc)(g->ud, ap->hash, ap->size * sizeof(AllocSite *), 0);
+  ap->hash = newhash;
+  ap->size = newsize;
+}
+
+
+/* add 'bytes' to the site of the given stack (dropped if no memory) */
+static void addsample (global_State *g, AllocProfile *ap,
+                       const char *stack, size_t len, size_t bytes) {
+  unsigned int h = luaS_hash(stack, len, g->seed);
+  AllocSite *s;
+  for (s = ap->hash[lmod(h, ap->size)]; s != NULL; s = s->next) {
+    if (s->hash == h && s->len == len && memcmp(s->stack, stack, len) == 0)
+      break;
+  }
+  if (s == NULL) {  /* new site? */
+    if (ap->nuse >= ap->size)
+      resizesites(g, ap, ap->size * 2);
+    s = cast(AllocSite *, (*g->frealloc)(g->ud, NULL, 0, sizesite(len)));
+    if (s == NULL)
+      return;
+    s->hash = h;
+    s->bytes = s->samples = 0;
+    s->len = len;
+    memcpy(s->stack, stack, len + 1);
+    s->next = ap->hash[lmod(h, ap->size)];
+    ap->hash[lmod(h, ap->size)] = s;
+    ap->nuse++;
+  }
+  s->bytes += bytes;
+  s->samples++;
+}
+
+
+/*
+** Called by the allocator when the countdown 'allocsample' runs out:
+** charges the bytes allocated since the last sample to the current
+** call stack. It runs before the allocation itself, while the stack
+** is still consistent.
+*/
+void luaG_allocsample (lua_State *L) {
+  global_State *g = G(L);
+  AllocProfile *ap = g->allocprof;
+  char buff[SAMPLEBUFF];
+  size_t len, bytes;
+  if (ap == NULL) {  /* not profiling? */
+    g->allocsample = MAX_LMEM;
+    return;
+  }
+  bytes = cast(size_t, ap->target - g->allocsample);
+  nextsample(g, ap);
+  len = foldstack(L, buff);
+  addsample(g, ap, buff, len, bytes);
+}
+
+
+void luaG_freeprofile (lua_State *L) {
+  global_State *g = G(L);
+  AllocProfile *ap = g->allocprof;
+  int i;
+  if (ap == NULL)
+    return;
+  for (i = 0; i < ap->size; i++) {
+    AllocSite *s = ap->hash[i];
+    while (s != NULL) {
+      AllocSite *next = s->next;
+      (*g->frealloc)(g->ud, s, sizesite(s->len), 0);
+      s = next;
+    }
+  }
+  (*g->frealloc)(g->ud, ap->hash, ap->size * sizeof(AllocSite *), 0);
+  (*g->frealloc)(g->ud, ap, sizeof(AllocProfile), 0);
+  g->allocprof = NULL;
+  g->allocsample = MAX_LMEM;
+}
+
+
+/*
+** Sample allocations every 'interval' bytes (on average); 0 stops the
+** profiler and discards its samples. Growing a block counts only the
+** bytes it gains. Returns the previous interval.
+*/
+LUA_API size_t lua_allocprofile (lua_State *L, size_t interval) {
+  global_State *g = G(L);
+  AllocProfile *ap;
+  size_t old;
+  lua_lock(L);
+  ap = g->allocprof;
+  old = (ap != NULL) ? ap->interval : 0;
+  if (interval == 0)
+    luaG_freeprofile(L);
+  else {
+    if (ap == NULL) {  /* start profiling? */
+      ap = cast(AllocProfile *,
+                (*g->frealloc)(g->ud, NULL, 0, sizeof(AllocProfile)));
+      if (ap == NULL) luaD_throw(L, LUA_ERRMEM);
+      ap->hash = cast(AllocSite **, (*g->frealloc)(g->ud, NULL, 0,
+                                          MINSITES * sizeof(AllocSite *)));
+      if (ap->hash == NULL) {
+        (*g->frealloc)(g->ud, ap, sizeof(AllocProfile), 0);
+        luaD_throw(L, LUA_ERRMEM);
+      }
+      ap->size = MINSITES;
+      ap->nuse = 0;
+      for (old = 0; old < MINSITES; old++)
+        ap->hash[old] = NULL;
+      old = 0;
+      ap->rand = g->seed | 1;  /* xorshift state cannot be 0 */
+      g->allocprof = ap;
+    }
+    ap->interval = interval;
+    nextsample(g, ap);
+  }
+  lua_unlock(L);
+  return old;
+}
+
+
+struct SiteCall {
+  lua_AllocSite f;
+  void *ud;
+};
+
+
+static void callsites (lua_State *L, void *ud) {
+  struct SiteCall *sc = cast(struct SiteCall *, ud);
+  AllocProfile *ap = G(L)->allocprof;
+  int i;
+  for (i = 0; i < ap->size; i++) {
+    AllocSite *s;
+    for (s = ap->hash[i]; s != NULL; s = s->next) {
+      lua_unlock(L);
+      sc->f(L, s->stack, s->bytes, s->samples, sc->ud);
+      lua_lock(L);
+    }
+  }
+}
+
+
+/*
+** Call 'f' for each sampled stack. No samples are taken meanwhile, so
+** 'f' may use the API (but must not change the profile). 'f' runs in
+** protected mode so that sampling resumes even if it raises an error,
+** which is then propagated.
+*/
+LUA_API void lua_allocsites (lua_State *L, lua_AllocSite f, void *ud) {
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  if (g->allocprof != NULL) {
+    l_mem countdown = g->allocsample;
+    struct SiteCall sc;
+    int status;
+    sc.f = f; sc.ud = ud;
+    g->allocsample = MAX_LMEM;  /* suspend sampling */
+    status = luaD_pcall(L, callsites, &sc, savestack(L, L->top), L->errfunc);
+    g->allocsample = countdown;  /* resume it */
+    if (status != LUA_OK)
+      luaD_throw(L, status);  /* propagate error */
+  }
+  lua_unlock(L);
+}
+
+/* }====================================================== */
@@ -45,8 +45,9 @@ LClosure *luaF_newLclosure (lua_State *L, int n) {
 void luaF_initupvals (lua_State *L, LClosure *cl) {
   int i;
   for (i = 0; i < cl->nupvalues; i++) {
-    UpVal *uv = luaM_new(L, UpVal);
+    UpVal *uv = luaM_newfixed(L, UpVal);
     uv->refcount = 1;
+    uv->old = 0;
     uv->v = &uv->u.value;  /* make it closed */
     setnilvalue(uv->v);
     cl->upvals[i] = uv;
@@ -69,8 +70,9 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
     pp = &p->u.open.next;
   }
   /* not found: create a new upvalue */
-  uv = luaM_new(L, UpVal);
+  uv = luaM_newfixed(L, UpVal);
   uv->refcount = 0;
+  uv->old = 0;
   uv->u.open.next = *pp;  /* link it to list of open upvalues */
   uv->u.open.touched = 1;
   *pp = uv;
@@ -89,7 +91,7 @@ void luaF_close (lua_State *L, StkId level) {  // 关掉在 level之前所有的
     lua_assert(upisopen(uv));
     L->openupval = uv->u.open.next;  /* remove from 'open' list */ 
     if (uv->refcount == 0)  /* no references? */   // 如果没有引用的话,直接释放掉
-      luaM_free(L, uv);  /* free upvalue */
+      luaM_freefixed(L, uv);  /* free upvalue */
     else {
       setobj(L, &uv->u.value, uv->v);  /* move value to upvalue slot */ // 如果还有人引用,就把它移动到
       uv->v = &uv->u.value;  /* now current value lives here */
@@ -132,7 +134,7 @@ void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
-  luaM_free(L, f);
+  luaM_freefixed(L, f);
 }
 
 
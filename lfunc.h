@@ -44,6 +44,7 @@
 struct UpVal {
   TValue *v;  /* points to stack or to its own value */
   lu_mem refcount;  /* reference counter */ // 引用计数,当没有人引用的话,就释放掉
+  lu_byte old;  /* may be used by an old closure (generational mode) */
   union {
     struct {  /* (when open) */  // 当upvalue打开的时候, TValue指针 指向open结构体
       UpVal *next;  /* linked list */  
@@ -10,7 +10,13 @@
 #include "lprefix.h"
 
 
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+
+#if defined(LUA_USE_PARALLELGC)
+#include <pthread.h>
+#endif
 
 #include "lua.h"
 
@@ -75,13 +81,19 @@
 #define makewhite(g,x)	\
  (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
-#define white2gray(x)	resetbits(x->marked, WHITEBITS)
-#define black2gray(x)	resetbit(x->marked, BLACKBIT)
+/* erases all color bits plus the age (generational mode) */
+#define maskgcbits	(maskcolors & ~AGEBITS)
+
+#define white2gray(x)	setmarked(x, getmarked(x) & ~WHITEBITS)
+#define black2gray(x)	setmarked(x, getmarked(x) & ~bitmask(BLACKBIT))
 
 // 是可回收对象并且是白色
 #define valiswhite(x)   (iscollectable(x) && iswhite(gcvalue(x)))
 
-#define checkdeadkey(n)	lua_assert(!ttisdeadkey(gkey(n)) || ttisnil(gval(n)))
+/* the key of node 'n' is a white collectable object */
+#define keyiswhite(n)   (keyiscollectable(n) && iswhite(gckey(n)))
+
+#define checkdeadkey(n)	lua_assert(!keyisdead(n) || ttisnil(gval(n)))
 
 
 #define checkconsistency(obj)  \
@@ -93,6 +105,11 @@
 
 #define markobject(g,t)	{ if (iswhite(t)) reallymarkobject(g, obj2gco(t)); }
 
+#define markkey(g,n)	{ if (keyiswhite(n)) reallymarkobject(g,gckey(n)); }
+
+/* collectable object of a value, or NULL if it is not collectable */
+#define gcvalueN(o)	(iscollectable(o) ? gcvalue(o) : NULL)
+
 /*
 ** mark an object that can be NULL (either because it is really optional,
 ** or it was stripped as debug info, or inside an uncompleted structure)
@@ -101,6 +118,9 @@
 #define markobjectN(g,t)	{ if (t) markobject(g,t); }
 
 static void reallymarkobject (global_State *g, GCObject *o);
+static void ephkeymarked (global_State *g, GCObject *o);
+static void addephentry (global_State *g, GCObject *key, TValue *value);
+static l_mem atomic (lua_State *L);
 
 
 /*
@@ -122,6 +142,30 @@ static void reallymarkobject (global_State *g, GCObject *o);
 #define linkgclist(o,p)	((o)->gclist = (p), (p) = obj2gco(o))
 
 
+#if defined(LUA_USE_PARALLELGC)
+/*
+** Clear the white bits of 'o' atomically, so that only one marker
+** visits it (see 'parallelpropagate'). Returns false if 'o' was not
+** white anymore.
+*/
+static int claimobject (GCObject *o) {
+  lu_byte m = __atomic_load_n(&o->marked, __ATOMIC_RELAXED);
+  do {
+    if (!(m & WHITEBITS))
+      return 0;
+  } while (!__atomic_compare_exchange_n(&o->marked, &m,
+                                        cast_byte(m & ~WHITEBITS), 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 1;
+}
+
+/* closures sharing an upvalue may be traversed by different markers */
+#define setupvalold(uv)	__atomic_store_n(&(uv)->old, 1, __ATOMIC_RELAXED)
+#else
+#define setupvalold(uv)	((uv)->old = 1)
+#endif
+
+
 /*
 ** If key is not marked, mark its entry as dead. This allows key to be
 ** collected, but keeps its entry in the table.  A dead node is needed
@@ -133,8 +177,8 @@ static void reallymarkobject (global_State *g, GCObject *o);
 */
 static void removeentry (Node *n) {
   lua_assert(ttisnil(gval(n)));
-  if (valiswhite(gkey(n)))
-    setdeadvalue(wgkey(n));  /* unused and unmarked key; remove it */
+  if (keyiswhite(n))
+    setdeadkey(n);  /* unused and unmarked key; remove it */
 }
 
 
@@ -145,13 +189,13 @@ static void removeentry (Node *n) {
 ** other objects: if really collected, cannot keep them; for objects
 ** being finalized, keep them in keys, but not in values
 */
-static int iscleared (global_State *g, const TValue *o) {
-  if (!iscollectable(o)) return 0;
-  else if (ttisstring(o)) {
-    markobject(g, tsvalue(o));  /* strings are 'values', so are never weak */
+static int iscleared (global_State *g, GCObject *o) {
+  if (o == NULL) return 0;  /* non-collectable value */
+  else if (novariant(o->tt) == LUA_TSTRING) {
+    markobject(g, o);  /* strings are 'values', so are never weak */
     return 0;
   }
-  else return iswhite(gcvalue(o));
+  else return iswhite(o);
 }
 
 
@@ -164,24 +208,35 @@ static int iscleared (global_State *g, const TValue *o) {
 void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
   lua_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
-  if (keepinvariant(g))  /* must keep invariant? */
+  if (keepinvariant(g)) {  /* must keep invariant? */
     reallymarkobject(g, v);  /* restore invariant */
+    if (isold(o)) {
+      lua_assert(!isold(v));  /* white object could not be old */
+      setage(v, G_OLD0);  /* restore generational invariant */
+    }
+  }
   else {  /* sweep phase */
     lua_assert(issweepphase(g));
-    makewhite(g, o);  /* mark main obj. as white to avoid other barriers */
+    if (g->gckind == KGC_INC)  /* incremental mode? */
+      makewhite(g, o);  /* mark main obj. as white to avoid other barriers */
   }
 }
 
 
 /*
 ** barrier that moves collector backward, that is, mark the black object
-** pointing to a white object as gray again.
+** pointing to a white object as gray again. In generational mode, the
+** table also becomes "touched", so that the next minor collections
+** revisit it ('grayagain' works as the remembered set).
 */
 void luaC_barrierback_ (lua_State *L, Table *t) {
   global_State *g = G(L);
   lua_assert(isblack(t) && !isdead(g, t));
   black2gray(t);  /* make table gray (again) */
-  linkgclist(t, g->grayagain);
+  if (getage(t) != G_TOUCHED2)  /* not already in 'grayagain'? */
+    linkgclist(t, g->grayagain);
+  if (isold(t))  /* generational mode? */
+    setage(t, G_TOUCHED1);  /* touched in current cycle */
 }
 
 
@@ -189,14 +244,21 @@ void luaC_barrierback_ (lua_State *L, Table *t) {
 ** barrier for assignments to closed upvalues. Because upvalues are
 ** shared among closures, it is impossible to know the color of all
 ** closures pointing to it. So, we assume that the object being assigned
-** must be marked.
+** must be marked. In generational mode, that is needed only when an
+** old closure may use the upvalue, and then the object becomes old too.
 */
 void luaC_upvalbarrier_ (lua_State *L, UpVal *uv) {
   global_State *g = G(L);
   GCObject *o = gcvalue(uv->v);
   lua_assert(!upisopen(uv));  /* ensured by macro luaC_upvalbarrier */
-  if (keepinvariant(g))
-    markobject(g, o);
+  if (keepinvariant(g) && iswhite(o)) {
+    if (g->gckind == KGC_INC)
+      reallymarkobject(g, o);
+    else if (uv->old) {
+      reallymarkobject(g, o);
+      setage(o, G_OLD0);
+    }
+  }
 }
 
 
@@ -210,6 +272,105 @@ void luaC_fix (lua_State *L, GCObject *o) {
 }
 
 
+/*
+** Visit object 'o' reachable from a table being frozen. Objects that
+** are not white (outside a collection) are already fixed, including
+** tables frozen before. Strings are immutable, so they are just marked;
+** tables are marked and linked into 'list' to have their contents
+** visited. Returns 0 for objects that cannot be frozen (functions,
+** userdata, threads, and tables with finalizers).
+*/
+static int freezeobject (GCObject *o, GCObject **list) {
+  if (!iswhite(o) || isfrozen(o))  /* already fixed or visited? */
+    return 1;
+  switch (o->tt) {
+    case LUA_TSHRSTR: case LUA_TLNGSTR: {
+      l_setbit(o->marked, FROZENBIT);
+      if (isslice(gco2ts(o)) && getslice(gco2ts(o))->parent != NULL)
+        return freezeobject(obj2gco(getslice(gco2ts(o))->parent), list);
+      return 1;
+    }
+    case LUA_TTABLE: {
+      if (tofinalize(o))
+        return 0;
+      l_setbit(o->marked, FROZENBIT);
+      linkgclist(gco2t(o), *list);
+      return 1;
+    }
+    default: return 0;
+  }
+}
+
+
+/*
+** Freeze table 't' and everything reachable from it (keys, values, and
+** metatables). Frozen tables cannot be modified, and all frozen objects
+** move to the 'fixedgc' list, gray forever, like 'luaC_fix' does: the
+** collector never traverses nor sweeps them again, and they live until
+** the state is closed. Returns 0, leaving every object as it was, if
+** the graph contains something that cannot be frozen.
+** Freezing works within this state only: frozen objects still belong
+** to it and cannot be shared with other states (which have their own
+** strings, metatables and allocator); that is out of scope.
+*/
+int luaC_freeze (lua_State *L, Table *t) {
+  global_State *g = G(L);
+  GCObject *list = NULL;
+  GCObject **p;
+  int ok;
+  int gen = (g->gckind == KGC_GEN);
+  if (gen)  /* moving objects would break the generational lists */
+    luaC_changemode(L, KGC_INC);
+  /* outside a collection, all objects in 'allgc' are white and the
+     'gclist' fields are free */
+  luaC_runtilstate(L, bitmask(GCSpause));
+  ok = freezeobject(obj2gco(t), &list);
+  while (ok && list != NULL) {
+    Table *h = gco2t(list);
+    Node *n, *limit = gnodelast(h);
+    unsigned int i;
+    list = h->gclist;
+    if (h->metatable)
+      ok = freezeobject(obj2gco(h->metatable), &list);
+    for (i = 0; ok && i < h->sizearray; i++) {
+      if (iscollectable(&h->array[i]))
+        ok = freezeobject(gcvalue(&h->array[i]), &list);
+    }
+    for (n = gnode(h, 0); ok && n < limit; n++) {
+      if (ttisnil(gval(n))) {
+        /* the key may be collected later, as 'h' will not be traversed */
+        if (keyiscollectable(n))
+          setdeadkey(n);
+      }
+      else {
+        if (keyiscollectable(n))
+          ok = freezeobject(gckey(n), &list);
+        if (ok && iscollectable(gval(n)))
+          ok = freezeobject(gcvalue(gval(n)), &list);
+      }
+    }
+  }
+  p = &g->allgc;
+  while (*p != NULL) {  /* fix marked objects (or unmark them) */
+    GCObject *curr = *p;
+    if (isfrozen(curr)) {
+      if (ok) {
+        white2gray(curr);  /* they will be gray forever */
+        *p = curr->next;  /* remove object from 'allgc' list */
+        curr->next = g->fixedgc;  /* link it to 'fixedgc' list */
+        g->fixedgc = curr;
+        continue;
+      }
+      resetbit(curr->marked, FROZENBIT);
+    }
+    p = &curr->next;
+  }
+  if (gen)
+    luaC_changemode(L, KGC_GEN);
+  return ok;
+}
+
+
 /*
 ** create a new collectable object (with given type and size) and link
 ** it to 'allgc' list.
@@ -248,7 +409,14 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
  reentry:
+#if defined(LUA_USE_PARALLELGC)
+  if (g->gcparallel && !claimobject(o))
+    return;  /* another marker got it first */
+#endif
   white2gray(o);
+  g->gcstats.marked[novariant(o->tt)]++;
+  if (g->ephindex)  /* converging ephemerons? */
+    ephkeymarked(g, o);  /* values waiting for this key can be marked */
   switch (o->tt) {
     case LUA_TSHRSTR: {
       gray2black(o);
@@ -256,8 +424,14 @@ static void reallymarkobject (global_State *g, GCObject *o) {
       break;
     }
     case LUA_TLNGSTR: {
+      TString *ts = gco2ts(o);
       gray2black(o);
-      g->GCmemtrav += sizelstring(gco2ts(o)->u.lnglen);
+      g->GCmemtrav += memlngstr(ts);
+      if (isslice(ts) && getslice(ts)->parent != NULL) {
+        o = obj2gco(getslice(ts)->parent);  /* mark its parent */
+        if (iswhite(o))
+          goto reentry;
+      }
       break;
     }
     case LUA_TUSERDATA: {
@@ -340,6 +514,13 @@ static void remarkupvals (global_State *g) {
           markvalue(g, uv->v);  /* remark upvalue's value */
           uv->u.open.touched = 0;
         }
+        if (g->gckind == KGC_GEN && uv->old && iscollectable(uv->v) &&
+            !isold(gcvalue(uv->v))) {
+          /* if the thread dies, its value moves into the upvalue while
+             barriers are off; keep it for the old closures */
+          markvalue(g, uv->v);
+          setage(gcvalue(uv->v), G_OLD0);
+        }
       }
     }
   }
@@ -368,6 +549,25 @@ static void restartcollection (global_State *g) {
 ** =======================================================
 */
 
+/*
+** In generational mode, a table leaving its traversal out of any gray
+** list must be black, so that the barriers can see it. Tables touched
+** in this cycle go back to 'grayagain', to be aged by
+** 'correctgraylists'; tables touched in the previous cycle are old now.
+*/
+static void genlink (global_State *g, Table *h) {
+  if (getage(h) == G_TOUCHED1) {  /* touched in this cycle? */
+    black2gray(h);
+    linkgclist(h, g->grayagain);  /* link it back in 'grayagain' */
+  }
+  else {
+    if (getage(h) == G_TOUCHED2)
+      changeage(h, G_TOUCHED2, G_OLD);  /* advance age */
+    gray2black(h);
+  }
+}
+
+
 /*
 ** Traverse a table with weak values and link it to proper list. During
 ** propagate phase, keep it in 'grayagain' list, to be revisited in the
@@ -384,9 +584,9 @@ static void traverseweakvalue (global_State *g, Table *h) {
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
     else {
-      lua_assert(!ttisnil(gkey(n)));
-      markvalue(g, gkey(n));  /* mark key */
-      if (!hasclears && iscleared(g, gval(n)))  /* is there a white value? */
+      lua_assert(!keyisnil(n));
+      markkey(g, n);  /* mark key */
+      if (!hasclears && iscleared(g, gcvalueN(gval(n))))  /* is there a white value? */
         hasclears = 1;  /* table will have to be cleared */
     }
   }
@@ -394,6 +594,8 @@ static void traverseweakvalue (global_State *g, Table *h) {
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
   else if (hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
+  else
+    genlink(g, h);
 }
 
 
@@ -425,10 +627,13 @@ static int traverseephemeron (global_State *g, Table *h) {
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
-    else if (iscleared(g, gkey(n))) {  /* key is not marked (yet)? */
+    else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
       hasclears = 1;  /* table must be cleared */
-      if (valiswhite(gval(n)))  /* value not marked yet? */
+      if (valiswhite(gval(n))) {  /* value not marked yet? */
         hasww = 1;  /* white-white entry */
+        if (g->ephindex)  /* converging? */
+          addephentry(g, gckey(n), gval(n));  /* wait for the key */
+      }
     }
     else if (valiswhite(gval(n))) {  /* value not marked yet? */
       marked = 1;
@@ -442,6 +647,8 @@ static int traverseephemeron (global_State *g, Table *h) {
     linkgclist(h, g->ephemeron);  /* have to propagate again */
   else if (hasclears)  /* table has white keys? */
     linkgclist(h, g->allweak);  /* may have to clean white keys */
+  else
+    genlink(g, h);
   return marked;
 }
 
@@ -456,21 +663,26 @@ static void traversestrongtable (global_State *g, Table *h) {
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
     else {
-      lua_assert(!ttisnil(gkey(n)));
-      markvalue(g, gkey(n));  /* mark key */
+      lua_assert(!keyisnil(n));
+      markkey(g, n);  /* mark key */
       markvalue(g, gval(n));  /* mark value */
     }
   }
+  genlink(g, h);
 }
 
 
+/* search 'c' in the weak mode 'mode' (which may not end in a '\0') */
+#define findmode(mode,c)  \
+	cast(const char *, memchr(svalue(mode), c, vslen(mode)))
+
 static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
   markobjectN(g, h->metatable);
   if (mode && ttisstring(mode) &&  /* is there a weak mode? */
-      ((weakkey = strchr(svalue(mode), 'k')),
-       (weakvalue = strchr(svalue(mode), 'v')),
+      ((weakkey = findmode(mode, 'k')),
+       (weakvalue = findmode(mode, 'v')),
        (weakkey || weakvalue))) {  /* is really weak? */
     black2gray(h);  /* keep table gray */
     if (!weakkey)  /* strong keys? */
@@ -533,6 +745,7 @@ static lu_mem traverseLclosure (global_State *g, LClosure *cl) {
   for (i = 0; i < cl->nupvalues; i++) {  /* mark its upvalues */
     UpVal *uv = cl->upvals[i];
     if (uv != NULL) {
+      setupvalold(uv);  /* 'cl' survives this cycle, so it may get old */
       if (upisopen(uv) && g->gcstate != GCSinsideatomic)
         uv->u.open.touched = 1;  /* can be marked in 'remarkupvals' */
       else
@@ -561,7 +774,8 @@ static lu_mem traversethread (global_State *g, lua_State *th) {
       g->twups = th;
     }
   }
-  else if (g->gckind != KGC_EMERGENCY)
+  if ((g->gcstate != GCSinsideatomic || g->gckind == KGC_GEN) &&
+      !g->gcemergency && !g->gcparallel)  /* (workers cannot allocate) */
     luaD_shrinkstack(th); /* do not change stack in emergency cycle */
   return (sizeof(lua_State) + sizeof(TValue) * th->stacksize +
           sizeof(CallInfo) * th->nci);
@@ -577,7 +791,7 @@ static lu_mem traversethread (global_State *g, lua_State *th) {
 static void propagatemark (global_State *g) {
   lu_mem size;
   GCObject *o = g->gray;
-  lua_assert(isgray(o));
+  lua_assert(isgray(o) || getage(o) == G_TOUCHED2);
   gray2black(o);
   switch (o->tt) {
     case LUA_TTABLE: {
@@ -622,8 +836,149 @@ static void propagateall (global_State *g) {
   while (g->gray) propagatemark(g);
 }
 
+/* }====================================================== */
+
 
-static void convergeephemerons (global_State *g) {
+/*
+** {======================================================
+** Ephemeron index
+** =======================================================
+*/
+
+/*
+** While ephemerons converge, each white-key -> white-value entry of an
+** ephemeron table is recorded in an index by its key. When a key is
+** marked ('reallymarkobject' calls 'ephkeymarked'), its entries move to
+** a list of values ready to be marked. So each entry is handled a fixed
+** number of times, instead of once per traversal of all ephemeron
+** tables until nothing changes. The index lives outside the heap (its
+** memory comes straight from the allocation function); if it cannot
+** grow, convergence falls back to repeated traversals.
+*/
+
+#define EPHBLOCK	256  /* number of entries in each block */
+#define MINEPHSIZE	64  /* initial size of the hash part */
+
+typedef struct EphEntry {
+  GCObject *key;
+  TValue *value;
+  struct EphEntry *next;  /* next entry in hash chain or 'ready' list */
+} EphEntry;
+
+typedef struct EphBlock {
+  struct EphBlock *previous;
+  EphEntry e[EPHBLOCK];
+} EphBlock;
+
+typedef struct EphIndex {
+  global_State *g;
+  EphEntry **hash;
+  int size;  /* size of 'hash' (a power of 2) */
+  int nuse;  /* number of entries in 'hash' */
+  EphEntry *ready;  /* entries whose keys were marked */
+  EphBlock *blocks;  /* list of blocks of entries */
+  int nfree;  /* free entries in first block */
+  int failed;  /* true if some entry could not be recorded */
+} EphIndex;
+
+
+#define ephhash(ix,o)	lmod(point2uint(o) >> 4, (ix)->size)
+
+
+static int growephhash (EphIndex *ix) {
+  global_State *g = ix->g;
+  int newsize = (ix->size == 0) ? MINEPHSIZE : ix->size * 2;
+  EphEntry **newhash = cast(EphEntry **, (*g->frealloc)(g->ud, NULL, 0,
+                                     newsize * sizeof(EphEntry *)));
+  int i, oldsize = ix->size;
+  if (newhash == NULL)
+    return 0;
+  for (i = 0; i < newsize; i++)
+    newhash[i] = NULL;
+  ix->size = newsize;
+  for (i = 0; i < oldsize; i++) {  /* rehash all entries */
+    EphEntry *e = ix->hash[i];
+    while (e != NULL) {
+      EphEntry *next = e->next;
+      int h = ephhash(ix, e->key);
+      e->next = newhash[h];
+      newhash[h] = e;
+      e = next;
+    }
+  }
+  (*g->frealloc)(g->ud, ix->hash, oldsize * sizeof(EphEntry *), 0);
+  ix->hash = newhash;
+  return 1;
+}
+
+
+static void addephentry (global_State *g, GCObject *key, TValue *value) {
+  EphIndex *ix = g->ephindex;
+  EphEntry *e;
+  int h;
+  if (ix->nuse >= ix->size && !growephhash(ix)) {
+    ix->failed = 1;
+    return;
+  }
+  if (ix->nfree == 0) {  /* first block is full? */
+    EphBlock *b = cast(EphBlock *,
+                       (*g->frealloc)(g->ud, NULL, 0, sizeof(EphBlock)));
+    if (b == NULL) {
+      ix->failed = 1;
+      return;
+    }
+    b->previous = ix->blocks;
+    ix->blocks = b;
+    ix->nfree = EPHBLOCK;
+  }
+  e = &ix->blocks->e[--ix->nfree];
+  e->key = key;
+  e->value = value;
+  h = ephhash(ix, key);
+  e->next = ix->hash[h];
+  ix->hash[h] = e;
+  ix->nuse++;
+}
+
+
+/* move all entries with key 'o' to the ready list */
+static void ephkeymarked (global_State *g, GCObject *o) {
+  EphIndex *ix = g->ephindex;
+  EphEntry **p;
+  if (ix->nuse == 0)
+    return;
+  p = &ix->hash[ephhash(ix, o)];
+  while (*p != NULL) {
+    EphEntry *e = *p;
+    if (e->key == o) {
+      *p = e->next;  /* remove it from the hash chain... */
+      e->next = ix->ready;  /* ...and put it in the ready list */
+      ix->ready = e;
+      ix->nuse--;
+    }
+    else
+      p = &e->next;
+  }
+}
+
+
+static void freeephindex (EphIndex *ix) {
+  global_State *g = ix->g;
+  EphBlock *b = ix->blocks;
+  while (b != NULL) {
+    EphBlock *previous = b->previous;
+    (*g->frealloc)(g->ud, b, sizeof(EphBlock), 0);
+    b = previous;
+  }
+  (*g->frealloc)(g->ud, ix->hash, ix->size * sizeof(EphEntry *), 0);
+}
+
+
+/*
+** Traverse all ephemeron tables until no more values can be marked.
+** (This is used only when the index runs out of memory.)
+*/
+static void traverseallephemerons (global_State *g) {
   int changed;
   do {
     GCObject *w;
@@ -640,148 +995,373 @@ static void convergeephemerons (global_State *g) {
   } while (changed);
 }
 
+
+/*
+** Traverse each ephemeron table once, recording its white-white
+** entries in the index; then propagate marks, marking the values of
+** entries whose keys get marked, until there is nothing left to mark.
+** Tables reached meanwhile are traversed by 'propagatemark' and record
+** their entries too. Tables with entries still pending at the end stay
+** in the 'ephemeron' list, as their keys are dead.
+*/
+static void convergeephemerons (global_State *g) {
+  EphIndex ix;
+  GCObject *w;
+  GCObject *next = g->ephemeron;  /* get ephemeron list */
+  ix.g = g;
+  ix.hash = NULL;
+  ix.size = ix.nuse = 0;
+  ix.ready = NULL;
+  ix.blocks = NULL;
+  ix.nfree = 0;
+  ix.failed = 0;
+  g->ephemeron = NULL;  /* tables may return to this list when traversed */
+  g->ephindex = &ix;
+  while ((w = next) != NULL) {
+    next = gco2t(w)->gclist;
+    traverseephemeron(g, gco2t(w));
+  }
+  for (;;) {
+    EphEntry *e;
+    propagateall(g);
+    if (ix.ready == NULL)
+      break;
+    while ((e = ix.ready) != NULL) {
+      ix.ready = e->next;
+      if (valiswhite(e->value))
+        reallymarkobject(g, gcvalue(e->value));
+    }
+  }
+  g->ephindex = NULL;
+  freeephindex(&ix);
+  if (ix.failed)  /* could not record some entry? */
+    traverseallephemerons(g);  /* go the slow way */
+}
+
 /* }====================================================== */
 
 
 /*
 ** {======================================================
-** Sweep Functions
+** Parallel marking
 ** =======================================================
 */
 
+#if defined(LUA_USE_PARALLELGC)
+
+/* maximum number of worker threads */
+#if !defined(LUAI_MAXGCWORKERS)
+#define LUAI_MAXGCWORKERS	64
+#endif
+
+/* number of objects the collector traverses alone before using workers */
+#define GCPARMIN	1024
+
+/* maximum number of gray objects handed over to another marker at once */
+#define GCCHUNK		64
+
+/* maximum number of chunks waiting for a marker */
+#define GCMAXCHUNKS	(4 * LUAI_MAXGCWORKERS)
+
 
 /*
-** clear entries with unmarked keys from all weaktables in list 'l' up
-** to element 'f'
+** A marker runs the usual traverse functions over a private copy of the
+** global state, so that its gray lists and its 'GCmemtrav' are its own
+** and the only shared writes are the claims of white objects (see
+** 'claimobject'). Marker 0 is the collecting thread itself; the others
+** run in worker threads.
 */
-static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
-  for (; l != f; l = gco2t(l)->gclist) {
-    Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
-    for (n = gnode(h, 0); n < limit; n++) {
-      if (!ttisnil(gval(n)) && (iscleared(g, gkey(n)))) {
-        setnilvalue(gval(n));  /* remove value ... */
-      }
-      if (ttisnil(gval(n)))  /* is entry empty? */
-        removeentry(n);  /* remove entry from table */
-    }
+typedef struct GCMarker {
+  global_State g;  /* private copy of the global state */
+  struct GCWorkers *w;  /* pool of this marker */
+  unsigned int phase;  /* last marking phase seen by this worker */
+  pthread_t thread;
+} GCMarker;
+
+
+typedef struct GCWorkers {
+  pthread_mutex_t lock;
+  pthread_cond_t work;  /* a phase started or there are new chunks */
+  pthread_cond_t done;  /* all workers finished the current phase */
+  unsigned int phase;  /* current marking phase */
+  int size;  /* number of workers allocated */
+  int n;  /* number of running worker threads */
+  int running;  /* workers still inside the current phase */
+  int idle;  /* markers waiting for work */
+  int quit;  /* true when workers must finish */
+  int nchunks;  /* number of entries in 'chunks' */
+  GCObject *chunks[GCMAXCHUNKS];  /* gray lists shared among markers */
+  GCMarker m[1];  /* markers (actually 'size + 1' of them) */
+} GCWorkers;
+
+
+#define sizeworkers(n)	(sizeof(GCWorkers) + (n) * sizeof(GCMarker))
+
+
+static GCObject **getgclist (GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: return &gco2t(o)->gclist;
+    case LUA_TLCL: return &gco2lcl(o)->gclist;
+    case LUA_TCCL: return &gco2ccl(o)->gclist;
+    case LUA_TTHREAD: return &gco2th(o)->gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    default: lua_assert(0); return NULL;
   }
 }
 
 
 /*
-** clear entries with unmarked values from all weaktables in list 'l' up
-** to element 'f'
+** Move up to GCCHUNK objects from the head of the gray list of a marker
+** to the pool, where an idle marker can take them. The marker keeps at
+** least one object for itself.
 */
-static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
-  for (; l != f; l = gco2t(l)->gclist) {
-    Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
-    unsigned int i;
-    for (i = 0; i < h->sizearray; i++) {
-      TValue *o = &h->array[i];
-      if (iscleared(g, o))  /* value was collected? */
-        setnilvalue(o);  /* remove value */
+static void sharework (GCWorkers *w, global_State *g) {
+  GCObject *last = g->gray;
+  int i;
+  for (i = 1; i < GCCHUNK && *getgclist(last) != NULL; i++)
+    last = *getgclist(last);
+  if (*getgclist(last) == NULL)
+    return;  /* list too short to be shared */
+  pthread_mutex_lock(&w->lock);
+  if (w->nchunks < GCMAXCHUNKS) {
+    w->chunks[w->nchunks++] = g->gray;
+    g->gray = *getgclist(last);
+    *getgclist(last) = NULL;
+    pthread_cond_signal(&w->work);
+  }
+  pthread_mutex_unlock(&w->lock);
+}
+
+
+/*
+** Propagate marks until all markers run out of gray objects. A marker
+** shares part of its list whenever some other marker is idle.
+*/
+static void parallelmark (GCMarker *m) {
+  GCWorkers *w = m->w;
+  global_State *g = &m->g;
+  int total = w->n + 1;
+  for (;;) {
+    int count = 0;
+    while (g->gray) {
+      propagatemark(g);
+      if (++count % GCCHUNK == 0 && g->gray != NULL &&
+          __atomic_load_n(&w->idle, __ATOMIC_RELAXED) > 0)
+        sharework(w, g);
     }
-    for (n = gnode(h, 0); n < limit; n++) {
-      if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
-        setnilvalue(gval(n));  /* remove value ... */
-        removeentry(n);  /* and remove entry from table */
-      }
+    pthread_mutex_lock(&w->lock);
+    __atomic_add_fetch(&w->idle, 1, __ATOMIC_RELAXED);  /* (read unlocked) */
+    while (w->nchunks == 0 && w->idle < total)
+      pthread_cond_wait(&w->work, &w->lock);
+    if (w->nchunks == 0) {  /* everybody is idle? */
+      pthread_cond_broadcast(&w->work);  /* phase is over */
+      pthread_mutex_unlock(&w->lock);
+      return;
     }
+    __atomic_sub_fetch(&w->idle, 1, __ATOMIC_RELAXED);
+    g->gray = w->chunks[--w->nchunks];
+    pthread_mutex_unlock(&w->lock);
   }
 }
 
 
-void luaC_upvdeccount (lua_State *L, UpVal *uv) {
-  lua_assert(uv->refcount > 0);
-  uv->refcount--;
-  if (uv->refcount == 0 && !upisopen(uv))
-    luaM_free(L, uv);
+static void *workermain (void *ud) {
+  GCMarker *m = cast(GCMarker *, ud);
+  GCWorkers *w = m->w;
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (w->phase == m->phase && !w->quit)
+      pthread_cond_wait(&w->work, &w->lock);
+    if (w->quit)
+      break;
+    m->phase = w->phase;
+    pthread_mutex_unlock(&w->lock);
+    parallelmark(m);
+    pthread_mutex_lock(&w->lock);
+    if (--w->running == 0)
+      pthread_cond_signal(&w->done);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
 }
 
 
-static void freeLclosure (lua_State *L, LClosure *cl) {
+/*
+** Add list 'l' (linked by 'gclist') to the front of list 'p'
+*/
+static void mergelist (GCObject **p, GCObject *l) {
+  if (l != NULL) {
+    GCObject *last = l;
+    while (*getgclist(last) != NULL)
+      last = *getgclist(last);
+    *getgclist(last) = *p;
+    *p = l;
+  }
+}
+
+
+/*
+** Bring back into 'g' the work done by a marker: its traversed memory,
+** the objects it left in gray lists, and the threads it linked back into
+** 'twups' (whose chain ends in 'twups', the original list). Threads were
+** not shrunk by the marker, as that allocates memory.
+*/
+static void joinmarker (global_State *g, global_State *mg,
+                        lua_State *twups) {
+  GCObject *o;
   int i;
-  for (i = 0; i < cl->nupvalues; i++) {
-    UpVal *uv = cl->upvals[i];
-    if (uv)
-      luaC_upvdeccount(L, uv);
+  lua_assert(mg->gray == NULL);
+  g->GCmemtrav += mg->GCmemtrav;
+  for (i = 0; i <= LUA_NUMTAGS; i++)
+    g->gcstats.marked[i] += mg->gcstats.marked[i];
+  if (g->gckind == KGC_GEN && !g->gcemergency) {
+    for (o = mg->grayagain; o != NULL; o = *getgclist(o))
+      if (o->tt == LUA_TTHREAD)
+        luaD_shrinkstack(gco2th(o));
+  }
+  mergelist(&g->grayagain, mg->grayagain);
+  mergelist(&g->weak, mg->weak);
+  mergelist(&g->ephemeron, mg->ephemeron);
+  mergelist(&g->allweak, mg->allweak);
+  if (mg->twups != twups) {
+    lua_State *th = mg->twups;
+    while (th->twups != twups)
+      th = th->twups;
+    th->twups = g->twups;
+    g->twups = mg->twups;
   }
-  luaM_freemem(L, cl, sizeLclosure(cl->nupvalues));
 }
 
 
-static void freeobj (lua_State *L, GCObject *o) {
-  switch (o->tt) {
-    case LUA_TPROTO: luaF_freeproto(L, gco2p(o)); break;
-    case LUA_TLCL: {
-      freeLclosure(L, gco2lcl(o));
-      break;
-    }
-    case LUA_TCCL: {
-      luaM_freemem(L, o, sizeCclosure(gco2ccl(o)->nupvalues));
-      break;
-    }
-    case LUA_TTABLE: luaH_free(L, gco2t(o)); break;
-    case LUA_TTHREAD: luaE_freethread(L, gco2th(o)); break;
-    case LUA_TUSERDATA: luaM_freemem(L, o, sizeudata(gco2u(o))); break;
-    case LUA_TSHRSTR:
-      luaS_remove(L, gco2ts(o));  /* remove it from hash table */
-      luaM_freemem(L, o, sizelstring(gco2ts(o)->shrlen));
-      break;
-    case LUA_TLNGSTR: {
-      luaM_freemem(L, o, sizelstring(gco2ts(o)->u.lnglen));
-      break;
-    }
-    default: lua_assert(0);
+/*
+** Spread the gray list among all markers and run a marking phase.
+*/
+static void parallelpropagate (global_State *g) {
+  GCWorkers *w = g->gcworkers;
+  lua_State *twups = g->twups;
+  int total = w->n + 1;
+  int i;
+  GCObject *o;
+  for (i = 0; i < total; i++) {
+    global_State *mg = &w->m[i].g;
+    *mg = *g;
+    mg->gcparallel = 1;
+    mg->gray = mg->grayagain = NULL;
+    mg->weak = mg->ephemeron = mg->allweak = NULL;
+    mg->GCmemtrav = 0;
+    memset(mg->gcstats.marked, 0, sizeof(mg->gcstats.marked));
   }
+  for (i = 0; (o = g->gray) != NULL; i = (i + 1) % total) {
+    global_State *mg = &w->m[i].g;
+    g->gray = *getgclist(o);
+    *getgclist(o) = mg->gray;
+    mg->gray = o;
+  }
+  pthread_mutex_lock(&w->lock);
+  __atomic_store_n(&w->idle, 0, __ATOMIC_RELAXED);
+  w->nchunks = 0;
+  w->running = w->n;
+  w->phase++;
+  pthread_cond_broadcast(&w->work);
+  pthread_mutex_unlock(&w->lock);
+  parallelmark(&w->m[0]);
+  pthread_mutex_lock(&w->lock);
+  while (w->running > 0)
+    pthread_cond_wait(&w->done, &w->lock);
+  pthread_mutex_unlock(&w->lock);
+  for (i = 0; i < total; i++)
+    joinmarker(g, &w->m[i].g, twups);
 }
 
 
-#define sweepwholelist(L,p)	sweeplist(L,p,MAX_LUMEM)
-static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count);
+static void stopworkers (lua_State *L, GCWorkers *w) {
+  int i;
+  pthread_mutex_lock(&w->lock);
+  w->quit = 1;
+  pthread_cond_broadcast(&w->work);
+  pthread_mutex_unlock(&w->lock);
+  for (i = 1; i <= w->n; i++)
+    pthread_join(w->m[i].thread, NULL);
+  pthread_cond_destroy(&w->done);
+  pthread_cond_destroy(&w->work);
+  pthread_mutex_destroy(&w->lock);
+  luaM_freemem(L, w, sizeworkers(w->size));
+}
 
 
 /*
-** sweep at most 'count' elements from a list of GCObjects erasing dead
-** objects, where a dead object is one marked with the old (non current)
-** white; change all non-dead objects back to white, preparing for next
-** collection cycle. Return where to continue the traversal or NULL if
-** list is finished.
+** Create a pool with (up to) 'n' workers. If the system cannot create
+** that many threads, go with the ones already created.
 */
-/* 如果是old 白, 就清除对象, 否则,将对象转换为白色, 准备进行下一轮循环
-  清除对象
-*/
-static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
-  global_State *g = G(L);
-  int ow = otherwhite(g);
-  int white = luaC_white(g);  /* current white */
-  while (*p != NULL && count-- > 0) {
-    GCObject *curr = *p;
-    int marked = curr->marked;
-    if (isdeadm(ow, marked)) {  /* is 'curr' dead? */
-      *p = curr->next;  /* remove 'curr' from list */
-      freeobj(L, curr);  /* erase 'curr' */
-    }
-    else {  /* change mark to 'white' */
-      curr->marked = cast_byte((marked & maskcolors) | white);
-      p = &curr->next;  /* go to next element */
-    }
+static GCWorkers *startworkers (lua_State *L, int n) {
+  GCWorkers *w = cast(GCWorkers *, luaM_malloc(L, sizeworkers(n)));
+  int i;
+  w->phase = 0;
+  w->size = n;
+  w->n = w->running = w->idle = w->quit = w->nchunks = 0;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->work, NULL);
+  pthread_cond_init(&w->done, NULL);
+  for (i = 0; i <= n; i++) {
+    w->m[i].w = w;
+    w->m[i].phase = 0;
   }
-  return (*p == NULL) ? NULL : p;
+  for (i = 1; i <= n; i++) {
+    if (pthread_create(&w->m[i].thread, NULL, workermain, &w->m[i]) != 0)
+      break;
+    w->n = i;
+  }
+  if (w->n == 0) {  /* could not create any thread? */
+    stopworkers(L, w);
+    return NULL;
+  }
+  return w;
+}
+
+#endif
+
+
+/*
+** Propagate all marks in the atomic phase, sharing the work with the
+** marking workers when there are enough objects to traverse.
+*/
+static void atomicpropagate (global_State *g) {
+#if defined(LUA_USE_PARALLELGC)
+  int i;
+  for (i = 0; i < GCPARMIN && g->gray != NULL; i++)
+    propagatemark(g);  /* small graphs are not worth the threads */
+  if (g->gray != NULL && g->gcworkers != NULL)
+    parallelpropagate(g);
+#endif
+  propagateall(g);
 }
 
 
 /*
-** sweep a list until a live object (or end of list)
+** Set the number of worker threads used for marking; returns the
+** previous number. Without LUA_USE_PARALLELGC, there are no workers.
 */
-static GCObject **sweeptolive (lua_State *L, GCObject **p) {
-  GCObject **old = p;
-  do {
-    p = sweeplist(L, p, 1);
-  } while (p == old);
-  return p;
+int luaC_setworkers (lua_State *L, int n) {
+#if defined(LUA_USE_PARALLELGC)
+  global_State *g = G(L);
+  GCWorkers *w = g->gcworkers;
+  int old = (w != NULL) ? w->n : 0;
+  if (n < 0)
+    n = 0;
+  else if (n > LUAI_MAXGCWORKERS)
+    n = LUAI_MAXGCWORKERS;
+  if (n != old) {
+    g->gcworkers = NULL;
+    if (w != NULL)
+      stopworkers(L, w);
+    if (n > 0)
+      g->gcworkers = startworkers(L, n);
+  }
+  return old;
+#else
+  UNUSED(L); UNUSED(n);
+  return 0;
+#endif
 }
 
 /* }====================================================== */
@@ -789,27 +1369,517 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 
 /*
 ** {======================================================
-** Finalization
+** Background sweeping
 ** =======================================================
 */
 
+#if defined(LUA_USE_PARALLELGC)
+
+/* number of blocks handed over to the sweeper at once */
+#define SWEEPBATCH	256
+
+
 /*
-** If possible, shrink string table
+** The list walks of the sweep phases stay in the collector: dead
+** objects still have to be removed from the string table, upvalues,
+** and lists that the program uses. But the memory of these objects
+** is released by the sweeper thread: while the collector frees dead
+** objects ('gcfreeing' true), 'luaM_realloc_' gives their blocks to
+** 'luaC_deferfree', which links them in batches through the blocks
+** themselves. (The allocator must accept frees from another thread.)
+** With LUA_USE_SLABS, small objects go back to the free lists of their
+** slabs instead, which is cheap but belongs to this thread; so only
+** larger blocks reach the sweeper.
 */
-static void checkSizes (lua_State *L, global_State *g) {
-  if (g->gckind != KGC_EMERGENCY) {
-    l_mem olddebt = g->GCdebt;
-    if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
-      luaS_resize(L, g->strt.size / 2);  /* shrink it a little */
-    g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
+typedef struct FreeBlock {
+  struct FreeBlock *next;
+  size_t size;
+} FreeBlock;
+
+
+typedef struct GCSweeper {
+  pthread_mutex_t lock;
+  pthread_cond_t work;  /* there are blocks to free (or thread must quit) */
+  pthread_cond_t idle;  /* all blocks were freed */
+  pthread_t thread;
+  lua_Alloc frealloc;  /* function used to free blocks */
+  void *ud;  /* auxiliary data to 'frealloc' */
+  FreeBlock *pending;  /* blocks handed over to the thread */
+  FreeBlock *batch;  /* blocks being collected for the next batch */
+  FreeBlock *batchlast;  /* last block in 'batch' */
+  int nbatch;  /* number of blocks in 'batch' */
+  int busy;  /* true while thread is freeing blocks */
+  int quit;  /* true when thread must finish */
+} GCSweeper;
+
+
+static void *sweepermain (void *ud) {
+  GCSweeper *s = cast(GCSweeper *, ud);
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    FreeBlock *b = s->pending;
+    if (b == NULL) {
+      s->busy = 0;
+      pthread_cond_broadcast(&s->idle);
+      if (s->quit)
+        break;
+      pthread_cond_wait(&s->work, &s->lock);
+      continue;
+    }
+    s->pending = NULL;
+    s->busy = 1;
+    pthread_mutex_unlock(&s->lock);
+    while (b != NULL) {
+      FreeBlock *next = b->next;
+      (*s->frealloc)(s->ud, b, b->size, 0);
+      b = next;
+    }
+    pthread_mutex_lock(&s->lock);
   }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
 }
 
-/*从 tobe fnz 上取下一个变量, 将其加入到allgc中, 清除他的 finalized 标识位,如果是在sweep阶段(已经过了扫描阶段).将其变为白色
-下个gc阶段处理 */
-static GCObject *udata2finalize (global_State *g) {
-  GCObject *o = g->tobefnz;  /* get first element */
-  lua_assert(tofinalize(o));
+
+/* wait until the sweeper has freed all blocks handed over to it */
+static void waitsweeper (GCSweeper *s) {
+  while (s->pending != NULL || s->busy)
+    pthread_cond_wait(&s->idle, &s->lock);
+}
+
+
+/*
+** Hand over current batch to the sweeper. If the program changed its
+** allocator, previous blocks are freed before the sweeper changes too.
+*/
+static void flushfree (global_State *g, GCSweeper *s) {
+  if (s->batch != NULL) {
+    pthread_mutex_lock(&s->lock);
+    if (s->frealloc != g->frealloc || s->ud != g->ud) {
+      waitsweeper(s);
+      s->frealloc = g->frealloc;
+      s->ud = g->ud;
+    }
+    s->batchlast->next = s->pending;
+    s->pending = s->batch;
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->lock);
+    s->batch = NULL;
+    s->nbatch = 0;
+  }
+}
+
+
+/*
+** Give a block being freed to the sweeper. Returns false if the block
+** is too small to be linked (and so must be freed by the caller).
+*/
+int luaC_deferfree (global_State *g, void *block, size_t size) {
+  GCSweeper *s = g->gcsweeper;
+  FreeBlock *b = cast(FreeBlock *, block);
+  if (size < sizeof(FreeBlock))
+    return 0;
+  b->size = size;
+  b->next = s->batch;
+  if (s->batch == NULL)
+    s->batchlast = b;
+  s->batch = b;
+  if (++s->nbatch >= SWEEPBATCH)
+    flushfree(g, s);
+  return 1;
+}
+
+
+/*
+** Make sure all memory freed by the collector was given back to the
+** allocator (e.g., before retrying an allocation after an emergency
+** collection).
+*/
+static void drainsweeper (global_State *g) {
+  GCSweeper *s = g->gcsweeper;
+  if (s != NULL) {
+    flushfree(g, s);
+    pthread_mutex_lock(&s->lock);
+    waitsweeper(s);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+
+static void stopsweeper (lua_State *L, GCSweeper *s) {
+  flushfree(G(L), s);
+  pthread_mutex_lock(&s->lock);
+  s->quit = 1;
+  pthread_cond_signal(&s->work);
+  pthread_mutex_unlock(&s->lock);
+  pthread_join(s->thread, NULL);
+  pthread_cond_destroy(&s->idle);
+  pthread_cond_destroy(&s->work);
+  pthread_mutex_destroy(&s->lock);
+  luaM_free(L, s);
+}
+
+
+static GCSweeper *startsweeper (lua_State *L) {
+  global_State *g = G(L);
+  GCSweeper *s = luaM_new(L, GCSweeper);
+  s->frealloc = g->frealloc;
+  s->ud = g->ud;
+  s->pending = s->batch = s->batchlast = NULL;
+  s->nbatch = s->busy = s->quit = 0;
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->work, NULL);
+  pthread_cond_init(&s->idle, NULL);
+  if (pthread_create(&s->thread, NULL, sweepermain, s) != 0) {
+    pthread_cond_destroy(&s->idle);
+    pthread_cond_destroy(&s->work);
+    pthread_mutex_destroy(&s->lock);
+    luaM_free(L, s);
+    return NULL;
+  }
+  return s;
+}
+
+
+/* emergency collections free memory by themselves */
+#define startfree(g)  \
+	((g)->gcfreeing = ((g)->gcsweeper != NULL && !(g)->gcemergency))
+#define flushsweeper(g)  \
+	{ if ((g)->gcsweeper) flushfree(g, (g)->gcsweeper); }
+
+
+/*
+** End of a sweep step: hand over the partial batch too, so that no
+** block waits between steps (when the program may change allocators).
+*/
+static void endfree (global_State *g) {
+  g->gcfreeing = 0;
+  flushsweeper(g);
+}
+
+#else
+
+#define startfree(g)	((void)0)
+#define endfree(g)	((void)0)
+#define flushsweeper(g)	((void)0)
+#define drainsweeper(g)	((void)0)
+
+#endif
+
+
+/*
+** Give back all memory freed by the collector through the current
+** allocator, which the program is about to change.
+*/
+void luaC_drainsweeper (global_State *g) {
+  UNUSED(g);
+  drainsweeper(g);
+}
+
+
+/*
+** Turn on or off the sweeper thread; returns its previous state.
+** Without LUA_USE_PARALLELGC, there is no sweeper.
+*/
+int luaC_setsweeper (lua_State *L, int on) {
+#if defined(LUA_USE_PARALLELGC)
+  global_State *g = G(L);
+  GCSweeper *s = g->gcsweeper;
+  if (on && s == NULL)
+    g->gcsweeper = startsweeper(L);
+  else if (!on && s != NULL) {
+    g->gcsweeper = NULL;
+    stopsweeper(L, s);
+  }
+  return (s != NULL);
+#else
+  UNUSED(L); UNUSED(on);
+  return 0;
+#endif
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Statistics
+** =======================================================
+*/
+
+/*
+** Current time in microseconds. ISO C only offers 'clock' (processor
+** time of the whole program); POSIX systems use a monotonic clock.
+*/
+static lu_mem gcmicrosecs (void) {
+#if defined(LUA_USE_POSIX)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lu_mem, ts.tv_sec) * 1000000 + cast(lu_mem, ts.tv_nsec / 1000);
+#else
+  return cast(lu_mem, (cast(double, clock()) / CLOCKS_PER_SEC) * 1e6);
+#endif
+}
+
+
+/*
+** Close the statistics of a cycle: they become the ones reported by
+** 'lua_gcstats', and the counters start again for the next cycle.
+*/
+static void endcycle (global_State *g, lu_mem now) {
+  size_t cycles = g->gcstats.cycles + 1;
+  if (now - g->gcstepstart > g->gcstats.maxstep)
+    g->gcstats.maxstep = now - g->gcstepstart;
+  g->gcstats.cycles = cycles;
+  g->gclaststats = g->gcstats;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  g->gcstats.cycles = cycles;
+  g->gcstepstart = now;  /* rest of this step goes to the next cycle */
+}
+
+
+/*
+** Charge the time since the last change to the phase being timed and
+** start timing phase 'newphase'. A cycle ends when it leaves the phase
+** of finalizers (to the pause in incremental mode, back to propagation
+** in generational mode). Time spent in finalizers is discounted by
+** 'GCTM', so it may be "in the future" after a nested collection.
+*/
+static void phasechange (lua_State *L, global_State *g, int newphase) {
+  lu_mem now = gcmicrosecs();
+  int oldphase = g->gcphase;
+  lua_assert(newphase < LUA_GCNPHASES);
+  if (now > g->gcphasestart)
+    g->gcstats.time[oldphase] += now - g->gcphasestart;
+  g->gcphasestart = now;
+  if (newphase != oldphase) {
+    g->gcphase = cast_byte(newphase);
+    if (oldphase == GCScallfin)
+      endcycle(g, now);
+    if (g->gchook)
+      (*g->gchook)(L, oldphase, newphase, g->gchookud);
+  }
+}
+
+
+/* check whether the last single step changed the phase */
+#define checkphase(L,g)  \
+	{ if ((g)->gcstate != (g)->gcphase) phasechange(L, g, (g)->gcstate); }
+
+
+static void startstep (global_State *g) {
+  g->gcstepstart = g->gcphasestart = gcmicrosecs();
+  g->gcstats.steps++;
+}
+
+
+static void endstep (lua_State *L, global_State *g) {
+  phasechange(L, g, g->gcphase);  /* charge time to current phase */
+  if (g->gcphasestart - g->gcstepstart > g->gcstats.maxstep)
+    g->gcstats.maxstep = g->gcphasestart - g->gcstepstart;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Sweep Functions
+** =======================================================
+*/
+
+
+/*
+** clear entries with unmarked keys from all weaktables in list 'l' up
+** to element 'f'
+*/
+static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
+  for (; l != f; l = gco2t(l)->gclist) {
+    Table *h = gco2t(l);
+    Node *n, *limit = gnodelast(h);
+    for (n = gnode(h, 0); n < limit; n++) {
+      if (!ttisnil(gval(n)) && (iscleared(g, gckeyN(n)))) {
+        setnilvalue(gval(n));  /* remove value ... */
+      }
+      if (ttisnil(gval(n)))  /* is entry empty? */
+        removeentry(n);  /* remove entry from table */
+    }
+  }
+}
+
+
+/*
+** clear entries with unmarked values from all weaktables in list 'l' up
+** to element 'f'
+*/
+static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
+  for (; l != f; l = gco2t(l)->gclist) {
+    Table *h = gco2t(l);
+    Node *n, *limit = gnodelast(h);
+    unsigned int i;
+    for (i = 0; i < h->sizearray; i++) {
+      TValue *o = &h->array[i];
+      if (iscleared(g, gcvalueN(o)))  /* value was collected? */
+        setnilvalue(o);  /* remove value */
+    }
+    for (n = gnode(h, 0); n < limit; n++) {
+      if (!ttisnil(gval(n)) && iscleared(g, gcvalueN(gval(n)))) {
+        setnilvalue(gval(n));  /* remove value ... */
+        removeentry(n);  /* and remove entry from table */
+      }
+    }
+  }
+}
+
+
+void luaC_upvdeccount (lua_State *L, UpVal *uv) {
+  lua_assert(uv->refcount > 0);
+  uv->refcount--;
+  if (uv->refcount == 0 && !upisopen(uv))
+    luaM_freefixed(L, uv);
+}
+
+
+static void freeLclosure (lua_State *L, LClosure *cl) {
+  int i;
+  for (i = 0; i < cl->nupvalues; i++) {
+    UpVal *uv = cl->upvals[i];
+    if (uv)
+      luaC_upvdeccount(L, uv);
+  }
+  luaM_freeobject(L, cl, sizeLclosure(cl->nupvalues));
+}
+
+
+static void freeobj (lua_State *L, GCObject *o) {
+  global_State *g = G(L);
+  l_mem olddebt = g->GCdebt;
+  int tag = novariant(o->tt);
+  switch (o->tt) {
+    case LUA_TPROTO: luaF_freeproto(L, gco2p(o)); break;
+    case LUA_TLCL: {
+      freeLclosure(L, gco2lcl(o));
+      break;
+    }
+    case LUA_TCCL: {
+      luaM_freeobject(L, o, sizeCclosure(gco2ccl(o)->nupvalues));
+      break;
+    }
+    case LUA_TTABLE: luaH_free(L, gco2t(o)); break;
+    case LUA_TTHREAD: luaE_freethread(L, gco2th(o)); break;
+    case LUA_TUSERDATA: luaM_freeobject(L, o, sizeudata(gco2u(o))); break;
+    case LUA_TSHRSTR:
+      luaS_remove(L, gco2ts(o));  /* remove it from hash table */
+      luaM_freeobject(L, o, sizelstring(gco2ts(o)->shrlen));
+      break;
+    case LUA_TLNGSTR: {
+      TString *ts = gco2ts(o);
+      if (isinterned(ts))
+        luaS_remove(L, ts);  /* remove it from table of medium strings */
+      if (isexternal(ts)) {  /* contents belong to the program? */
+        ExtString *es = getextstr(ts);
+        if (es->falloc != NULL)
+          (*es->falloc)(es->ud, es->sl.data, ts->u.lnglen + 1, 0);
+      }
+      else if (isslice(ts) && getslice(ts)->parent == NULL)  /* own copy? */
+        luaM_freearray(L, getslice(ts)->data, ts->u.lnglen + 1);
+      luaM_freeobject(L, o, sizelngstr(ts));
+      break;
+    }
+    default: lua_assert(0);
+  }
+  g->gcstats.freed[tag]++;
+  g->gcstats.freedbytes += olddebt - g->GCdebt;
+}
+
+
+#define sweepwholelist(L,p)	sweeplist(L,p,MAX_LUMEM)
+static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count);
+
+
+/*
+** sweep at most 'count' elements from a list of GCObjects erasing dead
+** objects, where a dead object is one marked with the old (non current)
+** white; change all non-dead objects back to white, preparing for next
+** collection cycle. Return where to continue the traversal or NULL if
+** list is finished.
+*/
+/* 如果是old 白, 就清除对象, 否则,将对象转换为白色, 准备进行下一轮循环
+  清除对象
+*/
+static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
+  global_State *g = G(L);
+  int ow = otherwhite(g);
+  int white = luaC_white(g);  /* current white */
+  startfree(g);
+  while (*p != NULL && count-- > 0) {
+    GCObject *curr = *p;
+    int marked = curr->marked;
+    if (isdeadm(ow, marked)) {  /* is 'curr' dead? */
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else {  /* change mark to 'white' */
+      curr->marked = cast_byte((marked & maskcolors) | white);
+      p = &curr->next;  /* go to next element */
+    }
+  }
+  endfree(g);
+  return (*p == NULL) ? NULL : p;
+}
+
+
+/*
+** sweep a list until a live object (or end of list)
+*/
+static GCObject **sweeptolive (lua_State *L, GCObject **p) {
+  GCObject **old = p;
+  do {
+    p = sweeplist(L, p, 1);
+  } while (p == old);
+  return p;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Finalization
+** =======================================================
+*/
+
+/*
+** If possible, shrink string table
+*/
+static void checkSizes (lua_State *L, global_State *g) {
+  if (!g->gcemergency) {
+    l_mem olddebt = g->GCdebt;
+    if (g->strt.nuse < g->strt.size / 4 &&  /* string table too big? */
+        g->strt.oldhash == NULL)  /* and not growing? */
+      luaS_resize(L, g->strt.size / 2);  /* shrink it a little */
+    if (g->medt.nuse < g->medt.size / 4 && g->medt.size > MINMEDTSIZE)
+      luaS_resizemedium(L, g->medt.size / 2);  /* same for medium strings */
+    g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
+  }
+}
+
+
+/*
+** Give back empty slabs; they are part of 'totalbytes', so the
+** estimate goes down with them.
+*/
+static void trimslabs (lua_State *L, global_State *g) {
+  l_mem olddebt = g->GCdebt;
+  luaM_trimslabs(L);
+  g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
+}
+
+/*从 tobe fnz 上取下一个变量, 将其加入到allgc中, 清除他的 finalized 标识位,如果是在sweep阶段(已经过了扫描阶段).将其变为白色
+下个gc阶段处理 */
+static GCObject *udata2finalize (global_State *g) {
+  GCObject *o = g->tobefnz;  /* get first element */
+  lua_assert(tofinalize(o));
   g->tobefnz = o->next;  /* remove it from 'tobefnz' list */
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
@@ -820,127 +1890,483 @@ static GCObject *udata2finalize (global_State *g) {
 }
 
 
-static void dothecall (lua_State *L, void *ud) {
-  UNUSED(ud);
-  luaD_callnoyield(L, L->top - 2, 0);
+static void dothecall (lua_State *L, void *ud) {
+  UNUSED(ud);
+  luaD_callnoyield(L, L->top - 2, 0);
+}
+
+/*
+GCTM函数的主要逻辑,就是不停的从tmudata链表中取出对象来,调⽤fasttm,使其调⽤根据metatable中注册的GC 函数来对udata对象数据进⾏回收.
+*/
+static void GCTM (lua_State *L, int propagateerrors) {
+  global_State *g = G(L);
+  const TValue *tm;
+  TValue v;
+  setgcovalue(L, &v, udata2finalize(g));
+  tm = luaT_gettmbyobj(L, &v, TM_GC);
+  if (tm != NULL && ttisfunction(tm)) {  /* is there a finalizer? */
+    int status;
+    lu_byte oldah = L->allowhook;
+    int running  = g->gcrunning;
+    lu_mem start = gcmicrosecs();
+    lu_mem elapsed;
+    L->allowhook = 0;  /* stop debug hooks during GC metamethod */
+    g->gcrunning = 0;  /* avoid GC steps */
+    setobj2s(L, L->top, tm);  /* push finalizer... */
+    setobj2s(L, L->top + 1, &v);  /* ... and its argument */
+    L->top += 2;  /* and (next line) call the finalizer */
+    L->ci->callstatus |= CIST_FIN;  /* will run a finalizer */
+    status = luaD_pcall(L, dothecall, NULL, savestack(L, L->top - 2), 0);
+    L->ci->callstatus &= ~CIST_FIN;  /* not running a finalizer anymore */
+    L->allowhook = oldah;  /* restore hooks */
+    g->gcrunning = running;  /* restore state */
+    elapsed = gcmicrosecs() - start;
+    g->gcstats.finalizers += elapsed;
+    g->gcphasestart += elapsed;  /* do not charge it to current phase */
+    if (status != LUA_OK && propagateerrors) {  /* error while running __gc? */
+      if (status == LUA_ERRRUN) {  /* is there an error object? */
+        const char *msg = "no message";
+        if (ttisstring(L->top - 1)) {
+          luaS_checkcstr(L, tsvalue(L->top - 1));
+          msg = svalue(L->top - 1);
+        }
+        luaO_pushfstring(L, "error in __gc metamethod (%s)", msg);
+        status = LUA_ERRGCMM;  /* error in __gc metamethod */
+      }
+      luaD_throw(L, status);  /* re-throw error */
+    }
+  }
+}
+
+
+/*
+** call a few (up to 'g->gcfinnum') finalizers
+*/
+static int runafewfinalizers (lua_State *L) {
+  global_State *g = G(L);
+  unsigned int i;
+  lua_assert(!g->tobefnz || g->gcfinnum > 0); /*g->gcfinnum was init as 1 */
+  for (i = 0; g->tobefnz && i < g->gcfinnum; i++)
+    GCTM(L, 1);  /* call one finalizer */
+  g->gcfinnum = (!g->tobefnz) ? 0  /* nothing more to finalize? */
+                    : g->gcfinnum * 2;  /* else call a few more next time 下次扩大2倍*/
+  return i;
+}
+
+
+/*
+** call all pending finalizers
+*/
+static void callallpendingfinalizers (lua_State *L) {
+  global_State *g = G(L);
+  while (g->tobefnz)
+    GCTM(L, 0);
+}
+
+
+/*
+** find last 'next' field in list 'p' list (to add elements in its end)
+*/
+static GCObject **findlast (GCObject **p) {
+  while (*p != NULL)
+    p = &(*p)->next;
+  return p;
+}
+
+
+/*
+** move all unreachable objects (or 'all' objects) that need
+** finalization from list 'finobj' to list 'tobefnz' (to be finalized).
+** (In generational mode, old objects cannot be unreachable.)
+*/
+static void separatetobefnz (global_State *g, int all) {
+  GCObject *curr;
+  GCObject **p = &g->finobj;
+  GCObject **lastnext = findlast(&g->tobefnz);
+  while ((curr = *p) != g->finobjold) {  /* traverse all finalizable objects */
+    lua_assert(tofinalize(curr));
+    if (!(iswhite(curr) || all))  /* not being collected? */
+      p = &curr->next;  /* don't bother with it */
+    else {
+      if (curr == g->finobjsur)  /* removing 'finobjsur'? */
+        g->finobjsur = curr->next;  /* correct it */
+      *p = curr->next;  /* remove 'curr' from 'finobj' list */
+      curr->next = *lastnext;  /* link at the end of 'tobefnz' list */
+      *lastnext = curr;
+      lastnext = &curr->next;
+    }
+  }
+}
+
+
+/*
+** In generational mode, pointers 'survival', 'old', and 'reallyold'
+** split 'allgc' in segments; when the object starting a segment leaves
+** the list, the segment starts at the next object.
+*/
+static void correctpointers (global_State *g, GCObject *o) {
+  if (o == g->survival) g->survival = o->next;
+  if (o == g->old) g->old = o->next;
+  if (o == g->reallyold) g->reallyold = o->next;
+}
+
+
+/*
+** if object 'o' has a finalizer, remove it from 'allgc' list (must
+** search the list to find it) and link it in 'finobj' list.
+*/
+void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
+  global_State *g = G(L);
+  if (tofinalize(o) ||                 /* obj. is already marked... */
+      gfasttm(g, mt, TM_GC) == NULL)   /* or has no finalizer? */
+    return;  /* nothing to be done */
+  else {  /* move 'o' to 'finobj' list */
+    GCObject **p;
+    if (issweepphase(g)) {
+      makewhite(g, o);  /* "sweep" object 'o' */
+      if (g->sweepgc == &o->next)  /* should not remove 'sweepgc' object */
+        g->sweepgc = sweeptolive(L, g->sweepgc);  /* change 'sweepgc' */
+    }
+    else
+      correctpointers(g, o);
+    /* search for pointer pointing to 'o' */
+    for (p = &g->allgc; *p != o; p = &(*p)->next) { /* empty */ }
+    *p = o->next;  /* remove 'o' from 'allgc' list */
+    o->next = g->finobj;  /* link it in 'finobj' list */
+    g->finobj = o;
+    l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
+  }
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Generational Collector
+** =======================================================
+*/
+
+
+/*
+** Sweep a list of objects in generational mode, from 'p' up to (not
+** including) 'limit'. Dead objects are freed; new objects that survive
+** go back to white (as survivals); other survivors advance their ages
+** and keep their colors. Returns where the sweep stopped.
+*/
+static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
+                            GCObject *limit) {
+  static const lu_byte nextage[] = {
+    G_SURVIVAL,  /* from G_NEW */
+    G_OLD1,      /* from G_SURVIVAL */
+    G_OLD1,      /* from G_OLD0 */
+    G_OLD,       /* from G_OLD1 */
+    G_OLD,       /* from G_OLD (do not change) */
+    G_TOUCHED1,  /* from G_TOUCHED1 (do not change) */
+    G_TOUCHED2   /* from G_TOUCHED2 (do not change) */
+  };
+  int white = luaC_white(g);
+  GCObject *curr;
+  startfree(g);
+  while ((curr = *p) != limit) {
+    if (iswhite(curr)) {  /* is 'curr' dead? */
+      lua_assert(!isold(curr) && isdead(g, curr));
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else {  /* correct mark and age */
+      if (getage(curr) == G_NEW) {  /* new objects go back to white */
+        int marked = curr->marked & maskgcbits;  /* erase GC bits */
+        curr->marked = cast_byte(marked | (G_SURVIVAL << AGESHIFT) | white);
+      }
+      else  /* all other objects will be old, and so keep their color */
+        setage(curr, nextage[getage(curr)]);
+      p = &curr->next;  /* go to next element */
+    }
+  }
+  endfree(g);
+  return p;
+}
+
+
+/*
+** Traverse a list making all its elements white and clearing their
+** age.
+*/
+static void whitelist (global_State *g, GCObject *p) {
+  int white = luaC_white(g);
+  for (; p != NULL; p = p->next)
+    p->marked = cast_byte((p->marked & maskgcbits) | white);
+}
+
+
+/*
+** Correct a list of gray objects. Because this correction is done
+** after sweeping, young objects can be white and still be alive. They
+** leave the list, as everything that can point to them will be
+** revisited anyway. Tables touched in this cycle stay in the list,
+** black (so that a new barrier puts them back to gray), as touched in
+** the previous cycle; non-white threads stay in the list, gray; all
+** other (old) objects leave the list, black.
+*/
+static GCObject **correctgraylist (GCObject **p) {
+  GCObject *curr;
+  while ((curr = *p) != NULL) {
+    GCObject **next = (curr->tt == LUA_TTHREAD) ? &gco2th(curr)->gclist
+                                                : &gco2t(curr)->gclist;
+    if (iswhite(curr))
+      *p = *next;  /* remove all white objects */
+    else if (getage(curr) == G_TOUCHED1) {  /* touched in this cycle? */
+      lua_assert(isgray(curr));
+      gray2black(curr);  /* make it black, for next barrier */
+      changeage(curr, G_TOUCHED1, G_TOUCHED2);
+      p = next;  /* keep it in the list and go to next element */
+    }
+    else if (curr->tt == LUA_TTHREAD) {
+      lua_assert(isgray(curr));
+      p = next;  /* keep non-white threads on the list */
+    }
+    else {  /* everything else is removed */
+      lua_assert(isold(curr));  /* young objects should be white here */
+      if (getage(curr) == G_TOUCHED2)  /* advance from TOUCHED2... */
+        changeage(curr, G_TOUCHED2, G_OLD);  /* ... to OLD */
+      gray2black(curr);  /* make object black (to be removed) */
+      *p = *next;
+    }
+  }
+  return p;
+}
+
+
+/*
+** Correct all gray lists, coalescing them into 'grayagain'.
+*/
+static void correctgraylists (global_State *g) {
+  GCObject **list = correctgraylist(&g->grayagain);
+  *list = g->weak; g->weak = NULL;
+  list = correctgraylist(list);
+  *list = g->allweak; g->allweak = NULL;
+  list = correctgraylist(list);
+  *list = g->ephemeron; g->ephemeron = NULL;
+  correctgraylist(list);
+}
+
+
+/*
+** Mark black 'OLD1' objects when starting a new young collection.
+** Gray objects are already in some gray list, and so will be visited
+** in the atomic step.
+*/
+static void markold (global_State *g, GCObject *from, GCObject *to) {
+  GCObject *p;
+  for (p = from; p != to; p = p->next) {
+    if (getage(p) == G_OLD1) {
+      lua_assert(!iswhite(p));
+      changeage(p, G_OLD1, G_OLD);  /* now they are old */
+      if (isblack(p)) {
+        black2gray(p);
+        reallymarkobject(g, p);
+      }
+    }
+  }
+}
+
+
+/*
+** Finish a young-generation collection.
+*/
+static void finishgencycle (lua_State *L, global_State *g) {
+  phasechange(L, g, GCSswpend);
+  correctgraylists(g);
+  flushsweeper(g);
+  checkSizes(L, g);
+  g->gcstate = GCSpropagate;  /* skip restart */
+  phasechange(L, g, GCScallfin);
+  if (!g->gcemergency) {
+    while (g->tobefnz)
+      GCTM(L, 1);  /* call all pending finalizers */
+  }
+  phasechange(L, g, GCSpropagate);
+}
+
+
+/*
+** Does a young collection. First, mark 'OLD1' objects. Then does the
+** atomic step. Then, sweep all lists and advance pointers. Finally,
+** finish the collection.
+*/
+static void youngcollection (lua_State *L, global_State *g) {
+  GCObject **psurvival;  /* to point to first non-dead survival object */
+  lua_assert(g->gcstate == GCSpropagate);
+  markold(g, g->allgc, g->reallyold);
+  markold(g, g->finobj, g->finobjrold);
+  markold(g, g->tobefnz, NULL);
+  phasechange(L, g, GCSatomic);
+  atomic(L);
+  /* sweep nursery and get a pointer to its last live element */
+  g->gcstate = GCSswpallgc;
+  phasechange(L, g, GCSswpallgc);
+  psurvival = sweepgen(L, g, &g->allgc, g->survival);
+  /* sweep 'survival' and 'old' */
+  sweepgen(L, g, psurvival, g->reallyold);
+  g->reallyold = g->old;
+  g->old = *psurvival;  /* 'survival' survivals are old now */
+  g->survival = g->allgc;  /* all news are survivals */
+  /* repeat for 'finobj' lists */
+  psurvival = sweepgen(L, g, &g->finobj, g->finobjsur);
+  /* sweep 'survival' and 'old' */
+  sweepgen(L, g, psurvival, g->finobjrold);
+  g->finobjrold = g->finobjold;
+  g->finobjold = *psurvival;  /* 'survival' survivals are old now */
+  g->finobjsur = g->finobj;  /* all news are survivals */
+  sweepgen(L, g, &g->tobefnz, NULL);
+  finishgencycle(L, g);
 }
 
+
 /*
-GCTM函数的主要逻辑,就是不停的从tmudata链表中取出对象来,调⽤fasttm,使其调⽤根据metatable中注册的GC 函数来对udata对象数据进⾏回收.
+** Sweep a list after a full collection, freeing dead objects and
+** making all survivors old: threads stay gray and go to 'grayagain',
+** to be revisited by every collection; everything else becomes black.
 */
-static void GCTM (lua_State *L, int propagateerrors) {
+static void sweep2old (lua_State *L, GCObject **p) {
+  GCObject *curr;
   global_State *g = G(L);
-  const TValue *tm;
-  TValue v;
-  setgcovalue(L, &v, udata2finalize(g));
-  tm = luaT_gettmbyobj(L, &v, TM_GC);
-  if (tm != NULL && ttisfunction(tm)) {  /* is there a finalizer? */
-    int status;
-    lu_byte oldah = L->allowhook;
-    int running  = g->gcrunning;
-    L->allowhook = 0;  /* stop debug hooks during GC metamethod */
-    g->gcrunning = 0;  /* avoid GC steps */
-    setobj2s(L, L->top, tm);  /* push finalizer... */
-    setobj2s(L, L->top + 1, &v);  /* ... and its argument */
-    L->top += 2;  /* and (next line) call the finalizer */
-    L->ci->callstatus |= CIST_FIN;  /* will run a finalizer */
-    status = luaD_pcall(L, dothecall, NULL, savestack(L, L->top - 2), 0);
-    L->ci->callstatus &= ~CIST_FIN;  /* not running a finalizer anymore */
-    L->allowhook = oldah;  /* restore hooks */
-    g->gcrunning = running;  /* restore state */
-    if (status != LUA_OK && propagateerrors) {  /* error while running __gc? */
-      if (status == LUA_ERRRUN) {  /* is there an error object? */
-        const char *msg = (ttisstring(L->top - 1))
-                            ? svalue(L->top - 1)
-                            : "no message";
-        luaO_pushfstring(L, "error in __gc metamethod (%s)", msg);
-        status = LUA_ERRGCMM;  /* error in __gc metamethod */
+  startfree(g);
+  while ((curr = *p) != NULL) {
+    if (iswhite(curr)) {  /* is 'curr' dead? */
+      lua_assert(isdead(g, curr));
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else {  /* all surviving objects become old */
+      setage(curr, G_OLD);
+      if (curr->tt == LUA_TTHREAD) {  /* threads must be watched */
+        lua_State *th = gco2th(curr);
+        linkgclist(th, g->grayagain);  /* insert into 'grayagain' list */
       }
-      luaD_throw(L, status);  /* re-throw error */
+      else  /* everything else is black */
+        gray2black(curr);
+      p = &curr->next;  /* go to next element */
     }
   }
+  endfree(g);
 }
 
 
 /*
-** call a few (up to 'g->gcfinnum') finalizers
+** Finish a full collection (after its atomic step) turning all
+** survivors old and entering generational mode. (The main thread is
+** not in 'allgc', so it is linked in 'grayagain' here.)
 */
-static int runafewfinalizers (lua_State *L) {
-  global_State *g = G(L);
-  unsigned int i;
-  lua_assert(!g->tobefnz || g->gcfinnum > 0); /*g->gcfinnum was init as 1 */
-  for (i = 0; g->tobefnz && i < g->gcfinnum; i++)
-    GCTM(L, 1);  /* call one finalizer */
-  g->gcfinnum = (!g->tobefnz) ? 0  /* nothing more to finalize? */
-                    : g->gcfinnum * 2;  /* else call a few more next time 下次扩大2倍*/
-  return i;
+static void atomic2gen (lua_State *L, global_State *g) {
+  g->gray = g->grayagain = NULL;  /* clear gray lists */
+  g->weak = g->allweak = g->ephemeron = NULL;
+  linkgclist(g->mainthread, g->grayagain);
+  /* sweep all elements making them old */
+  g->gcstate = GCSswpallgc;
+  phasechange(L, g, GCSswpallgc);
+  sweep2old(L, &g->allgc);
+  /* everything alive now is old */
+  g->reallyold = g->old = g->survival = g->allgc;
+  /* repeat for 'finobj' lists */
+  sweep2old(L, &g->finobj);
+  g->finobjrold = g->finobjold = g->finobjsur = g->finobj;
+  sweep2old(L, &g->tobefnz);
+  g->gckind = KGC_GEN;
+  g->GCestimate = gettotalbytes(g);  /* base for memory control */
+  finishgencycle(L, g);
 }
 
 
 /*
-** call all pending finalizers
+** Set debt for the next minor collection, which will happen when
+** memory grows 'genminormul'%.
 */
-static void callallpendingfinalizers (lua_State *L) {
-  global_State *g = G(L);
-  while (g->tobefnz)
-    GCTM(L, 0);
+static void setminordebt (global_State *g) {
+  luaE_setdebt(g, -(cast(l_mem, (gettotalbytes(g) / 100)) * g->genminormul));
+  luaM_setlimits(g);  /* re-arm the soft limit */
 }
 
 
 /*
-** find last 'next' field in list 'p' list (to add elements in its end)
+** Enter generational mode. Must go until the end of an atomic cycle
+** to ensure that all objects are correctly marked and weak tables
+** are cleared. Then, turn all objects into old and finish the
+** collection.
 */
-static GCObject **findlast (GCObject **p) {
-  while (*p != NULL)
-    p = &(*p)->next;
-  return p;
+static void entergen (lua_State *L, global_State *g) {
+  luaC_runtilstate(L, bitmask(GCSpause));  /* prepare to start a new cycle */
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  phasechange(L, g, GCSatomic);
+  atomic(L);  /* propagates all and then do the atomic stuff */
+  atomic2gen(L, g);
+  setminordebt(g);  /* set debt assuming next cycle will be minor */
 }
 
 
 /*
-** move all unreachable objects (or 'all' objects) that need
-** finalization from list 'finobj' to list 'tobefnz' (to be finalized)
+** Enter incremental mode. Turn all objects white, make all
+** intermediate lists point to NULL (to avoid invalid pointers),
+** and go to the pause state.
 */
-static void separatetobefnz (global_State *g, int all) {
-  GCObject *curr;
-  GCObject **p = &g->finobj;
-  GCObject **lastnext = findlast(&g->tobefnz);
-  while ((curr = *p) != NULL) {  /* traverse all finalizable objects */
-    lua_assert(tofinalize(curr));
-    if (!(iswhite(curr) || all))  /* not being collected? */
-      p = &curr->next;  /* don't bother with it */
-    else {
-      *p = curr->next;  /* remove 'curr' from 'finobj' list */
-      curr->next = *lastnext;  /* link at the end of 'tobefnz' list */
-      *lastnext = curr;
-      lastnext = &curr->next;
-    }
-  }
+static void enterinc (global_State *g) {
+  whitelist(g, g->allgc);
+  g->reallyold = g->old = g->survival = NULL;
+  whitelist(g, g->finobj);
+  whitelist(g, g->tobefnz);
+  g->finobjrold = g->finobjold = g->finobjsur = NULL;
+  makewhite(g, g->mainthread);
+  g->gcstate = GCSpause;
+  g->gckind = KGC_INC;
 }
 
 
 /*
-** if object 'o' has a finalizer, remove it from 'allgc' list (must
-** search the list to find it) and link it in 'finobj' list.
+** Change collector mode to 'newmode' (KGC_INC or KGC_GEN).
 */
-void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
+void luaC_changemode (lua_State *L, int newmode) {
   global_State *g = G(L);
-  if (tofinalize(o) ||                 /* obj. is already marked... */
-      gfasttm(g, mt, TM_GC) == NULL)   /* or has no finalizer? */
-    return;  /* nothing to be done */
-  else {  /* move 'o' to 'finobj' list */
-    GCObject **p;
-    if (issweepphase(g)) {
-      makewhite(g, o);  /* "sweep" object 'o' */
-      if (g->sweepgc == &o->next)  /* should not remove 'sweepgc' object */
-        g->sweepgc = sweeptolive(L, g->sweepgc);  /* change 'sweepgc' */
-    }
-    /* search for pointer pointing to 'o' */
-    for (p = &g->allgc; *p != o; p = &(*p)->next) { /* empty */ }
-    *p = o->next;  /* remove 'o' from 'allgc' list */
-    o->next = g->finobj;  /* link it in 'finobj' list */
-    g->finobj = o;
-    l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
+  if (newmode != g->gckind) {
+    startstep(g);
+    if (newmode == KGC_GEN)  /* entering generational mode? */
+      entergen(L, g);
+    else
+      enterinc(g);  /* entering incremental mode */
+    endstep(L, g);
+  }
+}
+
+
+/*
+** Does a full collection in generational mode.
+*/
+static void fullgen (lua_State *L, global_State *g) {
+  enterinc(g);
+  entergen(L, g);
+  trimslabs(L, g);
+}
+
+
+/*
+** Does a generational "step": a major (full) collection when memory
+** has grown 'gcpause'% since the last one, a minor collection
+** otherwise. (The base for major collections is kept across minor
+** ones.)
+*/
+static void genstep (lua_State *L, global_State *g) {
+  lu_mem majorbase = g->GCestimate;  /* memory after last major collection */
+  l_mem estimate = majorbase / PAUSEADJ;
+  l_mem threshold = (g->gcpause < MAX_LMEM / estimate)  /* overflow? */
+                  ? estimate * g->gcpause
+                  : MAX_LMEM;
+  if (cast(l_mem, gettotalbytes(g)) > threshold)
+    fullgen(L, g);  /* do a major collection */
+  else {
+    youngcollection(L, g);
+    setminordebt(g);
+    g->GCestimate = majorbase;  /* preserve base value */
   }
 }
 
@@ -966,12 +2392,19 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
 static void setpause (global_State *g) {
   l_mem threshold, debt;
   l_mem estimate = g->GCestimate / PAUSEADJ;  /* adjust 'estimate' */
+  /* the pacer starts a cycle after half its overhead (see 'pacedstep') */
+  int pause = (g->gcmaxpause > 0) ? PAUSEADJ + g->gcoverhead / 2
+                                  : g->gcpause;
   lua_assert(estimate > 0);
-  threshold = (g->gcpause < MAX_LMEM / estimate)  /* overflow? */
-            ? estimate * g->gcpause  /* no overflow 确保没有上溢*/
+  threshold = (pause < MAX_LMEM / estimate)  /* overflow? */
+            ? estimate * pause  /* no overflow 确保没有上溢*/
             : MAX_LMEM;  /* overflow; truncate to maximum */
   debt = gettotalbytes(g) - threshold;
   luaE_setdebt(g, debt);
+  g->gcthreshold = threshold;
+  g->gcpeak = 0;
+  g->gcbacklog = 0;
+  luaM_setlimits(g);  /* re-arm the soft limit */
 }
 
 
@@ -994,12 +2427,14 @@ static void entersweep (lua_State *L) {
 
 void luaC_freeallobjects (lua_State *L) {
   global_State *g = G(L);
+  luaC_setworkers(L, 0);  /* stop marking threads */
+  luaC_setsweeper(L, 0);
+  luaC_changemode(L, KGC_INC);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
   callallpendingfinalizers(L);
   lua_assert(g->tobefnz == NULL);
   g->currentwhite = WHITEBITS; /* this "white" makes all objects look dead */
-  g->gckind = KGC_NORMAL;
   sweepwholelist(L, &g->finobj);
   sweepwholelist(L, &g->allgc);
   sweepwholelist(L, &g->fixedgc);  /* collect fixed objects */
@@ -1012,6 +2447,7 @@ static l_mem atomic (lua_State *L) {
   l_mem work;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  g->grayagain = NULL;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread)); 
   g->gcstate = GCSinsideatomic; // 切换gc 状态,标识 inside gc atomic
@@ -1022,10 +2458,10 @@ static l_mem atomic (lua_State *L) {
   markmt(g);  /* mark global metatables */
   /* remark occasional upvalues of (maybe) dead threads */
   remarkupvals(g);
-  propagateall(g);  /* propagate changes */ /* 前面已经把一些变量 加入 gray 列表里面了,现在开始标记, 直到gray 链表为nil*/
+  atomicpropagate(g);  /* propagate changes */ /* 前面已经把一些变量 加入 gray 列表里面了,现在开始标记, 直到gray 链表为nil*/
   work = g->GCmemtrav;  /* stop counting (do not recount 'grayagain') */
   g->gray = grayagain;  /*  开始处理 gray again 链表*/
-  propagateall(g);  /* traverse 'grayagain' list */
+  atomicpropagate(g);  /* traverse 'grayagain' list */
   g->GCmemtrav = 0;  /* restart counting */
   convergeephemerons(g);
   /* at this point, all strongly accessible objects are marked. */
@@ -1037,7 +2473,7 @@ static l_mem atomic (lua_State *L) {
   separatetobefnz(g, 0);  /* separate objects to be finalized */ /* 把fnzobj链表上面需要回收的对象挂载到tobefnz链表上面*/
   g->gcfinnum = 1;  /* there may be objects to be finalized */
   markbeingfnz(g);  /* mark objects that will be finalized */ /* 标记需要 finalized 的对象*/
-  propagateall(g);  /* remark, to propagate 'resurrection'  finalized 引用的对象,会复活 标记为gray,就不会清理了 */
+  atomicpropagate(g);  /* remark, to propagate 'resurrection'  finalized 引用的对象,会复活 标记为gray,就不会清理了 */
   g->GCmemtrav = 0;  /* restart counting */
   convergeephemerons(g);
   /* at this point, all resurrected objects are marked. 此时，所有复活的对象都被标记了。 */
@@ -1074,7 +2510,8 @@ static lu_mem singlestep (lua_State *L) {
   global_State *g = G(L);
   switch (g->gcstate) {
     case GCSpause: { // 一步完成 标记起点（主线程，注册表，G的元表，上一次 GC 剩的 tobefnz （需要执行 __gc 元方法，执行后再放回 allgc 走常规回收流程）。
-      g->GCmemtrav = g->strt.size * sizeof(GCObject*);  // 短字符串默认已遍历
+      g->GCmemtrav = (g->strt.size + g->strt.oldsize + g->medt.size) *
+                     sizeof(GCObject*);  // 短字符串默认已遍历
       restartcollection(g);
       g->gcstate = GCSpropagate;  // 只执行一次,进入下一个状态
       return g->GCmemtrav;
@@ -1107,12 +2544,14 @@ static lu_mem singlestep (lua_State *L) {
     }
     case GCSswpend: {  /* finish sweeps */
       makewhite(g, g->mainthread);  /* sweep main thread */
+      flushsweeper(g);
+      trimslabs(L, g);
       checkSizes(L, g);
       g->gcstate = GCScallfin;
       return 0;
     }
     case GCScallfin: {  /* call remaining finalizers */
-      if (g->tobefnz && g->gckind != KGC_EMERGENCY) {
+      if (g->tobefnz && !g->gcemergency) {
         int n = runafewfinalizers(L);
         return (n * GCFINALIZECOST);
       }
@@ -1132,8 +2571,10 @@ static lu_mem singlestep (lua_State *L) {
 */
 void luaC_runtilstate (lua_State *L, int statesmask) {
   global_State *g = G(L);
-  while (!testbit(statesmask, g->gcstate))
+  while (!testbit(statesmask, g->gcstate)) {
     singlestep(L);
+    checkphase(L, g);
+  }
 }
 
 
@@ -1141,9 +2582,8 @@ void luaC_runtilstate (lua_State *L, int statesmask) {
 ** get GC debt and convert it from Kb to 'work units' (avoid zero debt
 ** and overflows)
 */
-static l_mem getdebt (global_State *g) {
+static l_mem getdebt (global_State *g, int stepmul) {
   l_mem debt = g->GCdebt;
-  int stepmul = g->gcstepmul;
   if (debt <= 0) return 0;  /* minimal debt */
   else {
     debt = (debt / STEPMULADJ) + 1;
@@ -1153,18 +2593,90 @@ static l_mem getdebt (global_State *g) {
 }
 
 /*
-** performs a basic GC step when collector is running
-收集器运行时执行基本的 GC 步骤
+** {======================================================
+** Latency pacer
+** =======================================================
 */
-void luaC_step (lua_State *L) {
-  global_State *g = G(L);
-  l_mem debt = getdebt(g);  /* GC deficit (be paid now) GC赤字*/
-  if (!g->gcrunning) {  /* not running? */
-    luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
-    return;
+
+/* limits for the work multiplier adjusted by the pacer */
+#define MINPACEMUL	40
+#define MAXPACEMUL	10000
+
+
+/*
+** At the end of a cycle, compare how much the heap grew while the
+** cycle was running ('gcpeak' over 'gcthreshold') with the allowance
+** for that growth (the other half of the overhead) and correct the
+** work multiplier: too much growth means the collector must do more
+** work per allocated byte; too little means it can do less.
+*/
+static void adjustpacer (global_State *g) {
+  l_mem allowance = cast(l_mem, (g->GCestimate / 200) * g->gcoverhead);
+  l_mem growth = cast(l_mem, g->gcpeak) - g->gcthreshold;
+  int mul = g->gcpacemul;
+  if (growth > allowance)
+    mul += mul / 4;  /* collector is too slow */
+  else if (growth < allowance / 2)
+    mul -= mul / 8;  /* collector is faster than needed */
+  g->gcpacemul = (mul < MINPACEMUL) ? MINPACEMUL
+               : (mul > MAXPACEMUL) ? MAXPACEMUL : mul;
+}
+
+
+/*
+** Incremental step under the latency pacer: instead of 'gcpause' and
+** 'gcstepmul', it tries to keep each step under 'gcmaxpause'
+** microseconds and the heap under 'gcoverhead' percent over the live
+** data. A step stops when its time is over, keeping the work not done
+** in 'gcbacklog' for the next step, which comes after a minimal
+** allocation. (The atomic phase cannot be split, so a step doing it
+** may take longer. In generational mode each step is a whole
+** collection, so the pacer does not apply.)
+*/
+static void pacedstep (lua_State *L, global_State *g) {
+  l_mem debt = getdebt(g, g->gcpacemul) + g->gcbacklog;
+  lu_mem start = gcmicrosecs();
+  lu_mem elapsed;
+  if (gettotalbytes(g) > g->gcpeak)
+    g->gcpeak = gettotalbytes(g);
+  do {  /* repeat until pause, enough "credit", or time is over */
+    lu_mem work = singlestep(L);
+    checkphase(L, g);
+    debt -= work;
+    elapsed = gcmicrosecs() - start;
+  } while (debt > -GCSTEPSIZE && g->gcstate != GCSpause &&
+           elapsed < g->gcmaxpause);
+  if (g->gcstate == GCSpause) {
+    adjustpacer(g);
+    setpause(g);  /* pause until next cycle */
+  }
+  else {
+    if (debt > 0) {  /* time is over with work still to do? */
+      g->gcbacklog = debt;
+      debt = -GCSTEPSIZE;  /* come back soon */
+    }
+    else {
+      g->gcbacklog = 0;
+      debt = (debt / g->gcpacemul) * STEPMULADJ;  /* convert to bytes */
+    }
+    luaE_setdebt(g, debt);
+    if (elapsed < g->gcmaxpause)
+      runafewfinalizers(L);
   }
+}
+
+/* }====================================================== */
+
+
+/*
+** Incremental step: performs work proportional to the debt, then
+** pauses until the next cycle or sets the debt for the next step.
+*/
+static void incstep (lua_State *L, global_State *g) {
+  l_mem debt = getdebt(g, g->gcstepmul);  /* GC deficit (be paid now) GC赤字*/
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */ // 返回memory traversed in this step
+    checkphase(L, g);
     debt -= work;
   } while (debt > -GCSTEPSIZE && g->gcstate != GCSpause);
   if (g->gcstate == GCSpause)
@@ -1177,6 +2689,27 @@ void luaC_step (lua_State *L) {
 }
 
 
+/*
+** performs a basic GC step when collector is running
+收集器运行时执行基本的 GC 步骤
+*/
+void luaC_step (lua_State *L) {
+  global_State *g = G(L);
+  if (!g->gcrunning) {  /* not running? */
+    luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
+    return;
+  }
+  startstep(g);
+  if (g->gckind == KGC_GEN)  /* generational mode? */
+    genstep(L, g);  /* does a whole (minor or major) collection */
+  else if (g->gcmaxpause > 0)  /* latency pacer? */
+    pacedstep(L, g);
+  else
+    incstep(L, g);
+  endstep(L, g);
+}
+
+
 /*
 ** Performs a full GC cycle; if 'isemergency', set a flag to avoid
 ** some operations which could change the interpreter state in some
@@ -1184,26 +2717,285 @@ void luaC_step (lua_State *L) {
 ** Before running the collection, check 'keepinvariant'; if it is true,
 ** there may be some objects marked as black, so the collector has
 ** to sweep all objects to turn them back to white (as white has not
-** changed, nothing will be collected).
+** changed, nothing will be collected). In generational mode, this is
+** a major collection.
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
-  lua_assert(g->gckind == KGC_NORMAL);
-  if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
-  if (keepinvariant(g)) {  /* black objects? */
-    entersweep(L); /* sweep everything to turn them back to white */
+  lua_assert(!g->gcemergency);
+  g->gcemergency = isemergency;  /* set flag */
+  startstep(g);
+  if (g->gckind == KGC_GEN)
+    fullgen(L, g);
+  else {
+    if (keepinvariant(g)) {  /* black objects? */
+      entersweep(L); /* sweep everything to turn them back to white */
+    }
+    /* finish any pending sweep phase to start a new cycle */
+    luaC_runtilstate(L, bitmask(GCSpause));
+    luaC_runtilstate(L, ~bitmask(GCSpause));  /* start new collection */
+    luaC_runtilstate(L, bitmask(GCScallfin));  /* run up to finalizers */
+    /* estimate must be correct after a full GC cycle */
+    lua_assert(g->GCestimate == gettotalbytes(g));
+    luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
+    setpause(g);
   }
-  /* finish any pending sweep phase to start a new cycle */
-  luaC_runtilstate(L, bitmask(GCSpause));
-  luaC_runtilstate(L, ~bitmask(GCSpause));  /* start new collection */
-  luaC_runtilstate(L, bitmask(GCScallfin));  /* run up to finalizers */
-  /* estimate must be correct after a full GC cycle */
-  lua_assert(g->GCestimate == gettotalbytes(g));
-  luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
-  g->gckind = KGC_NORMAL;
-  setpause(g);
+  if (isemergency)
+    drainsweeper(g);  /* give back memory freed in previous steps */
+  endstep(L, g);
+  g->gcemergency = 0;
 }
 
 /* }====================================================== */
 
 
+
+/*
+** {======================================================
+** Heap snapshots
+** =======================================================
+*/
+
+/*
+** A snapshot is a text stream: a header line, one line per root
+** ("root <id>") and one line per live object ("<id> <type> <size>"
+** followed by the ids of the objects it references). Ids are addresses.
+** It is written through a small buffer, so it needs no memory from
+** the state; the writer must not call back into Lua. References are
+** listed following the fields visited by the traversal functions
+** above (which cannot be used here, as they mark what they visit).
+*/
+
+#define HEAPBUFFSIZE	1024
+
+/* room for one token in the buffer */
+#define HEAPTOKEN	64
+
+typedef struct HeapDump {
+  lua_State *L;
+  lua_Writer writer;
+  void *data;
+  int status;  /* error returned by the writer (0 if none) */
+  size_t n;  /* number of bytes in the buffer */
+  char buff[HEAPBUFFSIZE];
+} HeapDump;
+
+
+static void heapflush (HeapDump *D) {
+  if (D->n > 0 && D->status == 0)
+    D->status = (*D->writer)(D->L, D->buff, D->n, D->data);
+  D->n = 0;
+}
+
+
+static void heapstring (HeapDump *D, const char *s) {
+  size_t l = strlen(s);
+  if (D->n + l > HEAPBUFFSIZE)
+    heapflush(D);
+  memcpy(D->buff + D->n, s, l);
+  D->n += l;
+}
+
+
+static void heapref (HeapDump *D, const void *p) {
+  char id[HEAPTOKEN];
+  id[0] = ' ';
+  lua_pointer2str(id + 1, sizeof(id) - 1, p);
+  heapstring(D, id);
+}
+
+
+#define heapvalue(D,o)	{ if (iscollectable(o)) heapref(D, gcvalue(o)); }
+#define heapobjectN(D,o)	{ if (o) heapref(D, o); }
+
+
+/* memory used by object 'o', as counted by the traversal functions */
+static lu_mem heapsize (GCObject *o) {
+  switch (o->tt) {
+    case LUA_TSHRSTR: return sizelstring(gco2ts(o)->shrlen);
+    case LUA_TLNGSTR: return memlngstr(gco2ts(o));
+    case LUA_TUSERDATA: return sizeudata(gco2u(o));
+    case LUA_TLCL: return sizeLclosure(gco2lcl(o)->nupvalues);
+    case LUA_TCCL: return sizeCclosure(gco2ccl(o)->nupvalues);
+    case LUA_TTABLE: {
+      Table *h = gco2t(o);
+      return sizeof(Table) + sizeof(TValue) * h->sizearray +
+                             sizeof(Node) * cast(size_t, allocsizenode(h));
+    }
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      return (sizeof(lua_State) + sizeof(TValue) * th->stacksize +
+              sizeof(CallInfo) * th->nci);
+    }
+    case LUA_TPROTO: {
+      Proto *f = gco2p(o);
+      return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+                             sizeof(Proto *) * f->sizep +
+                             sizeof(TValue) * f->sizek +
+                             sizeof(int) * f->sizelineinfo +
+                             sizeof(LocVar) * f->sizelocvars +
+                             sizeof(Upvaldesc) * f->sizeupvalues;
+    }
+    default: lua_assert(0); return 0;
+  }
+}
+
+
+static void heaptable (HeapDump *D, Table *h) {
+  Node *n, *limit = gnodelast(h);
+  unsigned int i;
+  heapobjectN(D, h->metatable);
+  for (i = 0; i < h->sizearray; i++)
+    heapvalue(D, &h->array[i]);
+  for (n = gnode(h, 0); n < limit; n++) {
+    if (!ttisnil(gval(n))) {
+      if (keyiscollectable(n))
+        heapref(D, gckey(n));
+      heapvalue(D, gval(n));
+    }
+  }
+}
+
+
+static void heapproto (HeapDump *D, Proto *f) {
+  int i;
+  heapobjectN(D, f->source);
+  for (i = 0; i < f->sizek; i++)
+    heapvalue(D, &f->k[i]);
+  for (i = 0; i < f->sizeupvalues; i++)
+    heapobjectN(D, f->upvalues[i].name);
+  for (i = 0; i < f->sizep; i++)
+    heapobjectN(D, f->p[i]);
+  for (i = 0; i < f->sizelocvars; i++)
+    heapobjectN(D, f->locvars[i].varname);
+}
+
+
+static void heapLclosure (HeapDump *D, LClosure *cl) {
+  int i;
+  heapobjectN(D, cl->p);
+  for (i = 0; i < cl->nupvalues; i++) {
+    UpVal *uv = cl->upvals[i];
+    if (uv != NULL)
+      heapvalue(D, uv->v);
+  }
+}
+
+
+static void heapthread (HeapDump *D, lua_State *th) {
+  StkId o = th->stack;
+  if (o == NULL)
+    return;  /* stack not completely built yet */
+  for (; o < th->top; o++)
+    heapvalue(D, o);
+}
+
+
+/* write the line of object 'o' */
+static void heapobject (HeapDump *D, GCObject *o) {
+  char tok[HEAPTOKEN];
+  lua_pointer2str(tok, sizeof(tok), o);
+  heapstring(D, tok);
+  heapstring(D, " ");
+  heapstring(D, ttypename(novariant(o->tt)));
+  heapstring(D, " ");
+  lua_integer2str(tok, sizeof(tok), cast(LUA_INTEGER, heapsize(o)));
+  heapstring(D, tok);
+  switch (o->tt) {
+    case LUA_TUSERDATA: {
+      TValue uvalue;
+      heapobjectN(D, gco2u(o)->metatable);
+      getuservalue(D->L, gco2u(o), &uvalue);
+      heapvalue(D, &uvalue);
+      break;
+    }
+    case LUA_TTABLE: heaptable(D, gco2t(o)); break;
+    case LUA_TLCL: heapLclosure(D, gco2lcl(o)); break;
+    case LUA_TCCL: {
+      CClosure *cl = gco2ccl(o);
+      int i;
+      for (i = 0; i < cl->nupvalues; i++)
+        heapvalue(D, &cl->upvalue[i]);
+      break;
+    }
+    case LUA_TTHREAD: heapthread(D, gco2th(o)); break;
+    case LUA_TPROTO: heapproto(D, gco2p(o)); break;
+    case LUA_TLNGSTR: {
+      if (isslice(gco2ts(o)))
+        heapobjectN(D, getslice(gco2ts(o))->parent);
+      break;
+    }
+    default: break;  /* short strings have no references */
+  }
+  heapstring(D, "\n");
+}
+
+
+static void heaplist (HeapDump *D, global_State *g, GCObject *o) {
+  for (; o != NULL && D->status == 0; o = o->next) {
+    if (!isdead(g, o))
+      heapobject(D, o);
+  }
+}
+
+
+static void heaproot (HeapDump *D, GCObject *o) {
+  heapstring(D, "root");
+  heapref(D, o);
+  heapstring(D, "\n");
+}
+
+
+/*
+** Write a snapshot of all live objects. Does not allocate memory, so
+** the collector cannot run while it is being written. The stream is
+** plain text, one record per line, fields separated by one space:
+**
+**   snapshot := "luaheap 1\n" root* object*
+**   root     := "root" " " id "\n"
+**   object   := id " " type " " size (" " id)* "\n"
+**
+** 'id' is the object address as printed by 'lua_pointer2str' (the
+** "%p" format); 'type' is one of "string", "table", "function",
+** "userdata", "thread" or "proto"; 'size' is a decimal byte count, as
+** charged by the collector (a slice does not count the bytes of its
+** parent, nor an external string its contents). Roots are the registry, the main
+** thread and the basic-type metatables, in that order. Each object
+** line lists every reference it holds, repeats included:
+**   table: metatable, array part, then key and value of each node;
+**   userdata: metatable, user value;
+**   function: prototype and upvalues (Lua), or upvalues (C);
+**   thread: stack values up to the top;
+**   proto: source, constants, upvalue names, nested protos and
+**     local variable names;
+**   string: the parent of a slice.
+** Every referenced id has its own object line. Any change to this
+** grammar must bump the version in the header ('debug.heapdiff'
+** rejects snapshots with another header).
+*/
+int luaC_heapdump (lua_State *L, lua_Writer writer, void *data) {
+  global_State *g = G(L);
+  HeapDump D;
+  int i;
+  D.L = L;
+  D.writer = writer;
+  D.data = data;
+  D.status = 0;
+  D.n = 0;
+  heapstring(&D, "luaheap 1\n");
+  heaproot(&D, gcvalue(&g->l_registry));
+  heaproot(&D, obj2gco(g->mainthread));
+  for (i = 0; i < LUA_NUMTAGS; i++) {
+    if (g->mt[i])
+      heaproot(&D, obj2gco(g->mt[i]));
+  }
+  heapobject(&D, obj2gco(g->mainthread));  /* not in any list */
+  heaplist(&D, g, g->allgc);
+  heaplist(&D, g, g->finobj);
+  heaplist(&D, g, g->tobefnz);
+  heaplist(&D, g, g->fixedgc);
+  heapflush(&D);
+  return D.status;
+}
+
+/* }====================================================== */
@@ -81,28 +81,69 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization  终结，结束，终止化 */
-/* bit 7 is currently used by tests (luaL_checkmemory) */
+#define FROZENBIT	4  /* object is frozen (see 'luaC_freeze') */
+/* bits 5-7 keep the age of the object in generational mode */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
 
 
-#define iswhite(x)      testbits((x)->marked, WHITEBITS)
+/*
+** With parallel marking, a marker may test the color of an object
+** while another marker (its owner) changes it; so, the collector uses
+** relaxed atomic accesses for these cases (plain loads and stores in
+** most machines).
+*/
+#if defined(LUA_USE_PARALLELGC)
+#define getmarked(x)	__atomic_load_n(&(x)->marked, __ATOMIC_RELAXED)
+#define setmarked(x,m)	__atomic_store_n(&(x)->marked, cast_byte(m), \
+                                         __ATOMIC_RELAXED)
+#else
+#define getmarked(x)	((x)->marked)
+#define setmarked(x,m)	((x)->marked = cast_byte(m))
+#endif
+
+
+#define iswhite(x)      testbits(getmarked(x), WHITEBITS)
 #define isblack(x)      testbit((x)->marked, BLACKBIT)
 #define isgray(x)  /* neither white nor black 既不白也不黑 */  \
 	(!testbits((x)->marked, WHITEBITS | bitmask(BLACKBIT)))
 
 #define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
 
+#define isfrozen(x)	testbit((x)->marked, FROZENBIT)
+
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	(!(((m) ^ WHITEBITS) & (ow)))
-#define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
+#define isdead(g,v)	isdeadm(otherwhite(g), getmarked(v))
 
 #define changewhite(x)	((x)->marked ^= WHITEBITS)
-#define gray2black(x)	l_setbit((x)->marked, BLACKBIT)
+#define gray2black(x)	setmarked(x, getmarked(x) | bitmask(BLACKBIT))
 
 #define luaC_white(g)	cast(lu_byte, (g)->currentwhite & WHITEBITS)
 
 
+/* object age in generational mode */
+#define G_NEW		0	/* created in current cycle */
+#define G_SURVIVAL	1	/* created in previous cycle */
+#define G_OLD0		2	/* marked old by frw. barrier in this cycle */
+#define G_OLD1		3	/* first full cycle as old */
+#define G_OLD		4	/* really old object (not to be visited) */
+#define G_TOUCHED1	5	/* old object touched this cycle */
+#define G_TOUCHED2	6	/* old object touched in previous cycle */
+
+#define AGESHIFT	5
+#define AGEBITS		(7 << AGESHIFT)  /* all age bits (111) */
+
+#define getage(o)	(((o)->marked & AGEBITS) >> AGESHIFT)
+#define setage(o,a)  setmarked(o, (getmarked(o) & (~AGEBITS)) | \
+                                ((a) << AGESHIFT))
+#define isold(o)	(getage(o) > G_SURVIVAL)
+
+#define changeage(o,f,t)  \
+	check_exp(getage(o) == (f), \
+	          setmarked(o, getmarked(o) ^ (((f)^(t)) << AGESHIFT)))
+
+
 /*
 ** Does one step of collection when debt becomes positive. 'pre'/'pos'
 ** allows some adjustments to be done only when needed. macro
@@ -148,6 +189,13 @@ LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
 LUAI_FUNC void luaC_upvalbarrier_ (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_upvdeccount (lua_State *L, UpVal *uv);
+LUAI_FUNC int luaC_freeze (lua_State *L, Table *t);
+LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+LUAI_FUNC int luaC_setworkers (lua_State *L, int n);
+LUAI_FUNC int luaC_setsweeper (lua_State *L, int on);
+LUAI_FUNC int luaC_deferfree (global_State *g, void *block, size_t size);
+LUAI_FUNC void luaC_drainsweeper (global_State *g);
+LUAI_FUNC int luaC_heapdump (lua_State *L, lua_Writer writer, void *data);
 
 
 #endif
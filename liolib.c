@@ -622,13 +622,15 @@ static int g_write (lua_State *L, FILE *f, int arg) {
   int status = 1;
   for (; nargs--; arg++) {
     if (lua_type(L, arg) == LUA_TNUMBER) {
-      /* optimization: could be done exactly as for strings */
-      int len = lua_isinteger(L, arg)
-                ? fprintf(f, LUA_INTEGER_FMT,
-                             (LUAI_UACINT)lua_tointeger(L, arg))
-                : fprintf(f, LUA_NUMBER_FMT,
-                             (LUAI_UACNUMBER)lua_tonumber(L, arg));
-      status = status && (len > 0);
+      /* optimization: written as 'tostring' does, without a string */
+      char buff[LUA_N2SBUFFSZ];
+      size_t len = lua_numbertocstring(L, arg, buff) - 1;
+      status = status && (fwrite(buff, sizeof(char), len, f) == len);
+    }
+    else if (luaL_testudata(L, arg, LUA_BUFFERHANDLE)) {
+      /* write a buffer directly, without making a string */
+      luaL_Membuf *mb = (luaL_Membuf *)lua_touserdata(L, arg);
+      status = status && (fwrite(mb->b, sizeof(char), mb->n, f) == mb->n);
     }
     else {
       size_t l;
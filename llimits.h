@@ -196,13 +196,39 @@ typedef unsigned long Instruction;
 
 
 /*
-** Size of cache for strings in the API. 'N' is the number of
-** sets (better be a prime) and "M" is the size of each set (M == 1
-** makes a direct cache.)
+** Long strings with up to 'internlen' bytes ("medium" strings) are
+** interned too, in a table of their own (see 'internmedstr').
+** LUAI_INTERNLEN is the initial value of 'internlen' (LUAI_MAXSHORTLEN
+** means no medium strings); 'lua_internlen' changes it, up to
+** LUAI_MAXINTERNLEN.
+*/
+#if !defined(LUAI_INTERNLEN)
+#define LUAI_INTERNLEN		LUAI_MAXSHORTLEN
+#endif
+
+#if !defined(LUAI_MAXINTERNLEN)
+#define LUAI_MAXINTERNLEN	256
+#endif
+
+/* minimum size for the table of medium strings */
+#if !defined(MINMEDTSIZE)
+#define MINMEDTSIZE	32
+#endif
+
+
+/*
+** Size of cache for strings in the API. 'N' is the initial number of
+** sets (a power of 2) and "M" is the size of each set (M == 1 makes a
+** direct cache.) While too many lookups miss, the number of sets
+** doubles up to 'STRCACHE_MAXN' (see 'luaS_new').
 */
 #if !defined(STRCACHE_N)
-#define STRCACHE_N		53
-#define STRCACHE_M		2
+#define STRCACHE_N		64
+#define STRCACHE_M		4
+#endif
+
+#if !defined(STRCACHE_MAXN)
+#define STRCACHE_MAXN		1024
 #endif
 
 
@@ -11,6 +11,7 @@
 
 
 #include <stddef.h>
+#include <stdlib.h>
 
 #include "lua.h"
 
@@ -42,6 +43,15 @@
 
 
 
+/*
+** Count 'n' bytes allocated towards the next sample of the allocation
+** profiler (see 'luaG_allocsample'). When the profiler is off, the
+** countdown starts at MAX_LMEM, so this is a single untaken branch.
+*/
+#define countalloc(L,g,n)  \
+	{ if (((g)->allocsample -= cast(l_mem, (n))) < 0) luaG_allocsample(L); }
+
+
 #define MINSIZEARRAY	4   
 
 // limit is MAX_INT
@@ -70,6 +80,80 @@ l_noret luaM_toobig (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Memory limits
+** =======================================================
+*/
+
+/* true if 'd' more bytes take the memory in use over 'limit' */
+#define overlimit(g,limit,d)  \
+	((d) > (limit) || gettotalbytes(g) > (limit) - (d))
+
+
+/*
+** Compute the next limit that allocations must check: the soft limit
+** until it is crossed, then the hard one. The collector calls this at
+** the end of each cycle, re-arming the soft limit once the memory in
+** use is back under it.
+*/
+void luaM_setlimits (global_State *g) {
+  lu_mem hard = (g->memhard > 0) ? g->memhard : MAX_LUMEM;
+  if (g->memsoftfired && gettotalbytes(g) < g->memsoft)
+    g->memsoftfired = 0;
+  if (g->memsoft > 0 && !g->memsoftfired && g->memsoft < hard)
+    g->memcheck = g->memsoft;
+  else
+    g->memcheck = hard;
+}
+
+
+static lu_mem callmemhook (lua_State *L, int what, lu_mem limit, lu_mem d) {
+  global_State *g = G(L);
+  lua_MemHook f = g->memhook;
+  if (f != NULL) {
+    size_t inuse = cast(size_t, gettotalbytes(g) + d);
+    lua_unlock(L);
+    limit = cast(lu_mem, (*f)(L, what, inuse, cast(size_t, limit),
+                              g->memhookud));
+    lua_lock(L);
+  }
+  return limit;
+}
+
+
+/*
+** An allocation of 'd' more bytes would cross 'memcheck'. Crossing the
+** soft limit calls the hook and makes the collector run at the next
+** check. The hard limit is never crossed: over it, try an emergency
+** collection and then the hook; if the state is still over the limit,
+** raise a memory error without calling the allocator.
+*/
+static void checklimits (lua_State *L, global_State *g, lu_mem d) {
+  if (g->memhard > 0 && overlimit(g, g->memhard, d)) {
+    if (g->version && !g->gcemergency)  /* can collect? */
+      luaC_fullgc(L, 1);
+    if (overlimit(g, g->memhard, d)) {
+      g->memhard = callmemhook(L, LUA_MEMHARD, g->memhard, d);
+      if (g->memhard > 0 && overlimit(g, g->memhard, d)) {
+        luaM_setlimits(g);
+        luaD_throw(L, LUA_ERRMEM);
+      }
+    }
+  }
+  if (g->memsoft > 0 && !g->memsoftfired && overlimit(g, g->memsoft, d)) {
+    if (g->GCdebt < 0)
+      luaE_setdebt(g, 0);  /* this allocation will start a step */
+    g->memsoft = callmemhook(L, LUA_MEMSOFT, g->memsoft, d);
+    /* a raised limit stays armed */
+    g->memsoftfired = (g->memsoft > 0 && overlimit(g, g->memsoft, d));
+  }
+  luaM_setlimits(g);
+}
+
+/* }====================================================== */
+
+
 //estimate 和 totalbytes 两个域，从名字上可以知道，它们分别表示了 lua vm 占用的内存字节数以及实际分配的字节数。
 /*
 ** generic allocation routine.
@@ -80,6 +164,17 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   global_State *g = G(L);  // 获取lua_state的全局状态
   size_t realosize = (block) ? osize : 0;
   lua_assert((realosize == 0) == (block == NULL));
+#if defined(LUA_USE_PARALLELGC)
+  if (nsize == 0 && g->gcfreeing && luaC_deferfree(g, block, realosize)) {
+    g->GCdebt -= realosize;  /* block now belongs to the sweeper thread */
+    return NULL;
+  }
+#endif
+  if (nsize > realosize) {  /* growing? */
+    if (overlimit(g, g->memcheck, nsize - realosize))
+      checklimits(L, g, nsize - realosize);
+    countalloc(L, g, nsize - realosize);  /* count only the new bytes */
+  }
 #if defined(HARDMEMTESTS)
   if (nsize > realosize && g->gcrunning)
     luaC_fullgc(L, 1);  /* force a GC whenever possible */
@@ -99,3 +194,238 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   return newblock;
 }
 
+
+
+/*
+** {======================================================
+** Slab allocator
+** =======================================================
+*/
+
+#if defined(LUA_USE_SLABS)
+
+/* size of each slab */
+#if !defined(LUAI_SLABSIZE)
+#define LUAI_SLABSIZE	16384
+#endif
+
+#define SLABGRAIN	16
+#define SLABMAX		(SLABCLASSES * SLABGRAIN)
+
+#define slabclass(s)	(cast_int(((s) - 1) / SLABGRAIN))
+#define classsize(c)	(cast(size_t, (c) + 1) * SLABGRAIN)
+
+/* number of blocks in each slab of class 'c' */
+#define slabblocks(c)	((LUAI_SLABSIZE - sizeof(Slab)) / classsize(c))
+
+#define nextblock(b)	(*cast(void **, (b)))
+
+
+/*
+** Small objects with a fixed size are carved from page-sized slabs;
+** each size class keeps its free blocks in a list in the global
+** state. Slabs come from (and go back to) the state allocator and are
+** counted whole in 'totalbytes', so free blocks and the slack at the
+** end of each slab count as memory in use, as they are: taking a block
+** from a free list costs nothing, a new slab is what moves the debt
+** and the memory limits.
+*/
+typedef struct Slab {
+  struct Slab *next;  /* next slab in its class */
+  size_t nfree;  /* free blocks in this slab (computed by 'trimclass') */
+} Slab;
+
+
+/*
+** Get a new slab for class 'c' and put all its blocks in the free list
+** of the class, in address order. If there is no memory, try an
+** emergency collection; it may free blocks of this class too (as may
+** the collection done when a new slab would cross the hard limit).
+*/
+static void newslab (lua_State *L, SlabClass *sc, int c) {
+  global_State *g = G(L);
+  size_t bsize = classsize(c);
+  size_t i, n = slabblocks(c);
+  char *blocks;
+  Slab *s;
+  if (overlimit(g, g->memcheck, LUAI_SLABSIZE)) {
+    checklimits(L, g, LUAI_SLABSIZE);
+    if (sc->freelist != NULL)  /* collection freed some block? */
+      return;
+  }
+  s = cast(Slab *, (*g->frealloc)(g->ud, NULL, 0, LUAI_SLABSIZE));
+  if (s == NULL) {
+    if (g->version) {  /* is state fully built? */
+      luaC_fullgc(L, 1);  /* try to free some memory... */
+      if (sc->freelist != NULL)  /* collection freed some block? */
+        return;
+      s = cast(Slab *, (*g->frealloc)(g->ud, NULL, 0, LUAI_SLABSIZE));
+    }
+    if (s == NULL)
+      luaD_throw(L, LUA_ERRMEM);
+  }
+  g->GCdebt += LUAI_SLABSIZE;
+  s->next = sc->slabs;
+  sc->slabs = s;
+  sc->nslabs++;
+  blocks = cast(char *, s + 1);
+  for (i = n; i > 0; i--) {  /* link blocks from last to first */
+    void *b = blocks + (i - 1) * bsize;
+    nextblock(b) = sc->freelist;
+    sc->freelist = b;
+  }
+  sc->nfree += n;
+}
+
+
+void *luaM_newobject_ (lua_State *L, int tag, size_t size) {
+  global_State *g = G(L);
+  if (size <= SLABMAX) {
+    SlabClass *sc = &g->slabs[slabclass(size)];
+    void *b;
+    countalloc(L, g, size);
+#if defined(HARDMEMTESTS)
+    if (g->gcrunning)
+      luaC_fullgc(L, 1);  /* force a GC whenever possible */
+#endif
+    if (sc->freelist == NULL)
+      newslab(L, sc, slabclass(size));
+    b = sc->freelist;
+    sc->freelist = nextblock(b);
+    sc->nfree--;
+    return b;
+  }
+  else
+    return luaM_realloc_(L, NULL, tag, size);
+}
+
+
+void luaM_freeobject_ (lua_State *L, void *block, size_t size) {
+  global_State *g = G(L);
+  if (size <= SLABMAX) {
+    SlabClass *sc = &g->slabs[slabclass(size)];
+    nextblock(block) = sc->freelist;
+    sc->freelist = block;
+    sc->nfree++;
+  }
+  else
+    luaM_realloc_(L, block, size, 0);
+}
+
+
+static int cmpslab (const void *a, const void *b) {
+  size_t sa = cast(size_t, *cast(Slab *const *, a));
+  size_t sb = cast(size_t, *cast(Slab *const *, b));
+  return (sa < sb) ? -1 : (sa > sb);
+}
+
+
+/* find the slab holding block 'b' in sorted array 'v' */
+static Slab *findslab (Slab **v, int n, void *b) {
+  size_t pb = cast(size_t, b);
+  int lo = 0, hi = n - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (cast(size_t, v[mid]) <= pb) lo = mid;
+    else hi = mid - 1;
+  }
+  return v[lo];
+}
+
+
+/*
+** Release the slabs of class 'c' whose blocks are all free (keeping
+** one of them for future allocations). Counting free blocks per slab
+** needs a sorted array of slabs; if there is no memory for it, the
+** class is left as it is.
+*/
+static void trimclass (global_State *g, SlabClass *sc, int c) {
+  size_t nblocks = slabblocks(c);
+  size_t vsize = sc->nslabs * sizeof(Slab *);
+  Slab **v = cast(Slab **, (*g->frealloc)(g->ud, NULL, 0, vsize));
+  Slab *s, **ps;
+  void *b, **pb;
+  int i, n = 0;
+  int keep = 1;  /* number of empty slabs to keep */
+  if (v == NULL)
+    return;
+  for (s = sc->slabs; s != NULL; s = s->next) {
+    s->nfree = 0;
+    v[n++] = s;
+  }
+  qsort(v, n, sizeof(Slab *), cmpslab);
+  for (b = sc->freelist; b != NULL; b = nextblock(b))
+    findslab(v, n, b)->nfree++;
+  for (i = 0; i < n; i++) {
+    if (v[i]->nfree == nblocks && keep > 0) {
+      v[i]->nfree = 0;  /* do not release this one */
+      keep--;
+    }
+  }
+  pb = &sc->freelist;
+  while ((b = *pb) != NULL) {  /* remove blocks of empty slabs */
+    if (findslab(v, n, b)->nfree == nblocks) {
+      *pb = nextblock(b);
+      sc->nfree--;
+    }
+    else
+      pb = cast(void **, b);
+  }
+  ps = &sc->slabs;
+  while ((s = *ps) != NULL) {  /* release empty slabs */
+    if (s->nfree == nblocks) {
+      *ps = s->next;
+      (*g->frealloc)(g->ud, s, LUAI_SLABSIZE, 0);
+      g->GCdebt -= LUAI_SLABSIZE;
+      g->gcstats.freedbytes += LUAI_SLABSIZE;
+      sc->nslabs--;
+    }
+    else
+      ps = &s->next;
+  }
+  (*g->frealloc)(g->ud, v, vsize, 0);
+}
+
+
+/*
+** Called after sweeping: release empty slabs of classes where at least
+** a quarter of the blocks (and a couple of slabs' worth) are free.
+*/
+void luaM_trimslabs (lua_State *L) {
+  global_State *g = G(L);
+  int c;
+  for (c = 0; c < SLABCLASSES; c++) {
+    SlabClass *sc = &g->slabs[c];
+    lu_mem nblocks = slabblocks(c);
+    if (sc->nfree >= 2 * nblocks && sc->nfree >= sc->nslabs * nblocks / 4)
+      trimclass(g, sc, c);
+  }
+}
+
+
+/*
+** Release all slabs (when closing the state, after all objects were
+** freed)
+*/
+void luaM_freeslabs (lua_State *L) {
+  global_State *g = G(L);
+  int c;
+  for (c = 0; c < SLABCLASSES; c++) {
+    SlabClass *sc = &g->slabs[c];
+    Slab *s = sc->slabs;
+    while (s != NULL) {
+      Slab *next = s->next;
+      (*g->frealloc)(g->ud, s, LUAI_SLABSIZE, 0);
+      g->GCdebt -= LUAI_SLABSIZE;
+      s = next;
+    }
+    sc->slabs = NULL;
+    sc->freelist = NULL;
+    sc->nfree = 0;
+    sc->nslabs = 0;
+  }
+}
+
+#endif
+
+/* }====================================================== */
@@ -50,7 +50,24 @@
 #define luaM_newvector(L,n,t) \
 		cast(t *, luaM_reallocv(L, NULL, 0, n, sizeof(t)))
 
+/*
+** Objects that keep their size for life (collectable objects, upvalues,
+** and CallInfo structures) come from the slab allocator when small
+** (with LUA_USE_SLABS), and must be freed with 'luaM_freeobject' (or
+** 'luaM_freefixed').
+*/
+#if defined(LUA_USE_SLABS)
+#define luaM_newobject(L,tag,s)	luaM_newobject_(L, tag, (s))
+#define luaM_freeobject(L,b,s)	luaM_freeobject_(L, (b), (s))
+#else
 #define luaM_newobject(L,tag,s)	luaM_realloc_(L, NULL, tag, (s))
+#define luaM_freeobject(L,b,s)	luaM_realloc_(L, (b), (s), 0)
+#define luaM_trimslabs(L)	((void)(L))
+#define luaM_freeslabs(L)	((void)0)
+#endif
+
+#define luaM_newfixed(L,t)	cast(t *, luaM_newobject(L, 0, sizeof(t)))
+#define luaM_freefixed(L,b)	luaM_freeobject(L, (b), sizeof(*(b)))
 
 #define luaM_growvector(L,v,nelems,size,t,limit,e) \
           if ((nelems)+1 > (size)) \
@@ -59,6 +76,8 @@
 #define luaM_reallocvector(L, v,oldn,n,t) \
    ((v)=cast(t *, luaM_reallocv(L, v, oldn, n, sizeof(t))))  // 在这里承接了realloc 内存的返回值
 
+struct global_State;
+
 LUAI_FUNC l_noret luaM_toobig (lua_State *L);
 
 /* not to be called directly */
@@ -67,6 +86,13 @@ LUAI_FUNC void *luaM_realloc_ (lua_State *L, void *block, size_t oldsize,
 LUAI_FUNC void *luaM_growaux_ (lua_State *L, void *block, int *size,
                                size_t size_elem, int limit,
                                const char *what);
+LUAI_FUNC void luaM_setlimits (struct global_State *g);
+#if defined(LUA_USE_SLABS)
+LUAI_FUNC void *luaM_newobject_ (lua_State *L, int tag, size_t size);
+LUAI_FUNC void luaM_freeobject_ (lua_State *L, void *block, size_t size);
+LUAI_FUNC void luaM_trimslabs (lua_State *L);
+LUAI_FUNC void luaM_freeslabs (lua_State *L);
+#endif
 
 #endif
 
@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <float.h>
 #include <locale.h>
 #include <math.h>
 #include <stdarg.h>
@@ -175,6 +176,150 @@ static int isneg (const char **s) {
 
 
 
+/*
+** {==================================================================
+** 64-bit helpers for the conversions between numbers and strings
+** ===================================================================
+*/
+
+#if defined(LLONG_MAX)	/* { */
+
+#define SWARDIGITS	/* can read decimal digits 8 at a time */
+
+typedef unsigned long long DWord;  /* (assumed to have 64 bits) */
+
+
+/* read 8 bytes as a little-endian word (a single load on most machines) */
+static DWord readword8 (const char *p) {
+  const unsigned char *u = cast(const unsigned char *, p);
+  return cast(DWord, u[0]) | (cast(DWord, u[1]) << 8) |
+         (cast(DWord, u[2]) << 16) | (cast(DWord, u[3]) << 24) |
+         (cast(DWord, u[4]) << 32) | (cast(DWord, u[5]) << 40) |
+         (cast(DWord, u[6]) << 48) | (cast(DWord, u[7]) << 56);
+}
+
+
+/* true if all bytes of 'w' are in '0'-'9' */
+#define isdigits8(w)  \
+  ((((w) & 0xF0F0F0F0F0F0F0F0ULL) | \
+   ((((w) + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == \
+   0x3333333333333333ULL)
+
+
+/*
+** Value of the 8 digits in 'w' (first digit in the lowest byte):
+** digits are combined in pairs, then in fours, then all eight, with
+** a multiplication for each step.
+*/
+static unsigned long digits8 (DWord w) {
+  w -= 0x3030303030303030ULL;
+  w = (w * 10) + (w >> 8);
+  w = (((w & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+       (((w >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+  return cast(unsigned long, w);
+}
+
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && DBL_MANT_DIG == 53	/* { */
+
+#define DIYFP	/* can convert doubles with DiyFp arithmetic */
+
+/* a "do-it-yourself" float: f * 2^e */
+typedef struct DiyFp {
+  DWord f;
+  int e;
+} DiyFp;
+
+
+/* normalized 10^-348, 10^-340, ..., 10^340 */
+static const struct { DWord f; short e; } cachedpow[] = {
+  {0xFA8FD5A0081C0288ULL, -1220}, {0xBAAEE17FA23EBF76ULL, -1193},
+  {0x8B16FB203055AC76ULL, -1166}, {0xCF42894A5DCE35EAULL, -1140},
+  {0x9A6BB0AA55653B2DULL, -1113}, {0xE61ACF033D1A45DFULL, -1087},
+  {0xAB70FE17C79AC6CAULL, -1060}, {0xFF77B1FCBEBCDC4FULL, -1034},
+  {0xBE5691EF416BD60CULL, -1007}, {0x8DD01FAD907FFC3CULL, -980},
+  {0xD3515C2831559A83ULL, -954}, {0x9D71AC8FADA6C9B5ULL, -927},
+  {0xEA9C227723EE8BCBULL, -901}, {0xAECC49914078536DULL, -874},
+  {0x823C12795DB6CE57ULL, -847}, {0xC21094364DFB5637ULL, -821},
+  {0x9096EA6F3848984FULL, -794}, {0xD77485CB25823AC7ULL, -768},
+  {0xA086CFCD97BF97F4ULL, -741}, {0xEF340A98172AACE5ULL, -715},
+  {0xB23867FB2A35B28EULL, -688}, {0x84C8D4DFD2C63F3BULL, -661},
+  {0xC5DD44271AD3CDBAULL, -635}, {0x936B9FCEBB25C996ULL, -608},
+  {0xDBAC6C247D62A584ULL, -582}, {0xA3AB66580D5FDAF6ULL, -555},
+  {0xF3E2F893DEC3F126ULL, -529}, {0xB5B5ADA8AAFF80B8ULL, -502},
+  {0x87625F056C7C4A8BULL, -475}, {0xC9BCFF6034C13053ULL, -449},
+  {0x964E858C91BA2655ULL, -422}, {0xDFF9772470297EBDULL, -396},
+  {0xA6DFBD9FB8E5B88FULL, -369}, {0xF8A95FCF88747D94ULL, -343},
+  {0xB94470938FA89BCFULL, -316}, {0x8A08F0F8BF0F156BULL, -289},
+  {0xCDB02555653131B6ULL, -263}, {0x993FE2C6D07B7FACULL, -236},
+  {0xE45C10C42A2B3B06ULL, -210}, {0xAA242499697392D3ULL, -183},
+  {0xFD87B5F28300CA0EULL, -157}, {0xBCE5086492111AEBULL, -130},
+  {0x8CBCCC096F5088CCULL, -103}, {0xD1B71758E219652CULL, -77},
+  {0x9C40000000000000ULL, -50}, {0xE8D4A51000000000ULL, -24},
+  {0xAD78EBC5AC620000ULL, 3}, {0x813F3978F8940984ULL, 30},
+  {0xC097CE7BC90715B3ULL, 56}, {0x8F7E32CE7BEA5C70ULL, 83},
+  {0xD5D238A4ABE98068ULL, 109}, {0x9F4F2726179A2245ULL, 136},
+  {0xED63A231D4C4FB27ULL, 162}, {0xB0DE65388CC8ADA8ULL, 189},
+  {0x83C7088E1AAB65DBULL, 216}, {0xC45D1DF942711D9AULL, 242},
+  {0x924D692CA61BE758ULL, 269}, {0xDA01EE641A708DEAULL, 295},
+  {0xA26DA3999AEF774AULL, 322}, {0xF209787BB47D6B85ULL, 348},
+  {0xB454E4A179DD1877ULL, 375}, {0x865B86925B9BC5C2ULL, 402},
+  {0xC83553C5C8965D3DULL, 428}, {0x952AB45CFA97A0B3ULL, 455},
+  {0xDE469FBD99A05FE3ULL, 481}, {0xA59BC234DB398C25ULL, 508},
+  {0xF6C69A72A3989F5CULL, 534}, {0xB7DCBF5354E9BECEULL, 561},
+  {0x88FCF317F22241E2ULL, 588}, {0xCC20CE9BD35C78A5ULL, 614},
+  {0x98165AF37B2153DFULL, 641}, {0xE2A0B5DC971F303AULL, 667},
+  {0xA8D9D1535CE3B396ULL, 694}, {0xFB9B7CD9A4A7443CULL, 720},
+  {0xBB764C4CA7A44410ULL, 747}, {0x8BAB8EEFB6409C1AULL, 774},
+  {0xD01FEF10A657842CULL, 800}, {0x9B10A4E5E9913129ULL, 827},
+  {0xE7109BFBA19C0C9DULL, 853}, {0xAC2820D9623BF429ULL, 880},
+  {0x80444B5E7AA7CF85ULL, 907}, {0xBF21E44003ACDD2DULL, 933},
+  {0x8E679C2F5E44FF8FULL, 960}, {0xD433179D9C8CB841ULL, 986},
+  {0x9E19DB92B4E31BA9ULL, 1013}, {0xEB96BF6EBADF77D9ULL, 1039},
+  {0xAF87023B9BF0EE6BULL, 1066}
+};
+
+
+static const DWord powten[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+  10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+  100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+  100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+  100000000000000000ULL, 1000000000000000000ULL,
+  10000000000000000000ULL
+};
+
+
+static DiyFp diynormalize (DiyFp x) {
+  while (!(x.f & (1ULL << 63))) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+
+/* upper half of the 128-bit product, rounded */
+static DiyFp diymul (DiyFp x, DiyFp y) {
+  DWord a = x.f >> 32, b = x.f & 0xFFFFFFFFu;
+  DWord c = y.f >> 32, d = y.f & 0xFFFFFFFFu;
+  DWord ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  DWord mid = (bd >> 32) + (ad & 0xFFFFFFFFu) + (bc & 0xFFFFFFFFu);
+  DiyFp r;
+  mid += 1u << 31;  /* round */
+  r.f = ac + (ad >> 32) + (bc >> 32) + (mid >> 32);
+  r.e = x.e + y.e + 64;
+  return r;
+}
+
+#endif							/* } */
+
+#endif							/* } */
+
+/* }================================================================== */
+
+
+
 /*
 ** {==================================================================
 ** Lua's implementation for 'lua_strx2number'
@@ -244,24 +389,156 @@ static lua_Number lua_strx2number (const char *s, char **endptr) {
 /* }====================================================== */
 
 
-/* maximum length of a numeral */
-#if !defined (L_MAXLENNUM)
-#define L_MAXLENNUM	200
+#if defined(DIYFP)	/* { */
+
+/* powers of ten that are exact in a double */
+static const double exactpow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/*
+** Compute w * 10^q, for 'w' with at most 19 digits ('nd'), correctly
+** rounded. When both 'w' and 10^q are exact doubles, one operation
+** does it (Clinger's fast path); otherwise the product is computed
+** with DiyFp arithmetic, keeping the bound 'err' on its error (in
+** eighths of the last bit), as in double-conversion's 'DiyFpStrtod'.
+** Return 0 when the result may be off (too close to halfway between
+** two doubles, or not a normal double); 'lua_str2number' must decide.
+*/
+static int diystrtod (DWord w, int nd, int q, lua_Number *result) {
+  DiyFp v;
+  DWord half, lowbits, m, bits;
+  int i, sh, be;
+  unsigned int err = 0;
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+  if (w <= (1ULL << 53) && -22 <= q && q <= 22) {
+    double r = cast(double, w);
+    *result = (q < 0) ? r / exactpow10[-q] : r * exactpow10[q];
+    return 1;
+  }
 #endif
+  if (q < -348 || q > 347)  /* out of the table? */
+    return 0;
+  v.f = w; v.e = 0;
+  v = diynormalize(v);
+  i = (q + 348) / 8;
+  if ((q + 348) % 8 != 0) {  /* multiply by the remaining 10^1 to 10^7 */
+    DiyFp adj;
+    adj.f = powten[(q + 348) % 8]; adj.e = 0;
+    v = diymul(v, diynormalize(adj));
+    if (nd + (q + 348) % 8 > 19)  /* product did not fit in 64 bits? */
+      err += 4;  /* rounded: half a unit */
+    sh = v.e;
+    v = diynormalize(v);
+    err <<= sh - v.e;
+  }
+  {
+    DiyFp c;
+    c.f = cachedpow[i].f; c.e = cachedpow[i].e;  /* 10^(q - q % 8) */
+    v = diymul(v, c);
+  }
+  err += 4 + 4 + (err != 0);  /* errors of the power and of the product */
+  sh = v.e;
+  v = diynormalize(v);
+  err <<= sh - v.e;
+  be = v.e + 64 + 1022;  /* biased exponent of the result */
+  if (be < 1 || be > 0x7FE)  /* not normal (or out of range)? */
+    return 0;
+  /* keep the 53 upper bits, rounding the 11 lower ones */
+  lowbits = (v.f & 0x7FF) * 8;
+  half = 0x400 * 8;
+  if (half - err < lowbits && lowbits < half + err)
+    return 0;  /* too close to call */
+  m = v.f >> 11;
+  if (lowbits > half) m++;
+  if (m == (1ULL << 53)) {  /* rounding carried to a new bit? */
+    m >>= 1;
+    be++;
+  }
+  if (be > 0x7FE)
+    bits = cast(DWord, 0x7FF) << 52;  /* overflow: inf */
+  else
+    bits = (cast(DWord, be) << 52) | (m & ((1ULL << 52) - 1));
+  memcpy(result, &bits, sizeof(bits));
+  return 1;
+}
+
+
+/*
+** Read a plain decimal numeral in [s, e): optional sign, digits with
+** an optional radix mark (a dot or the locale's), and an optional
+** exponent. Return NULL if the numeral has another format, more than
+** 19 significant digits, or is a hard case for 'diystrtod'.
+*/
+static const char *l_str2dfast (const char *s, const char *e,
+                                lua_Number *result) {
+  int dot = lua_getlocaledecpoint();
+  DWord w = 0;  /* significant digits */
+  int nd = 0;  /* number of significant digits */
+  int q = 0;  /* decimal exponent */
+  int any = 0;  /* true if some digit was read */
+  int neg = 0;
+  while (s < e && lisspace(cast_uchar(*s))) s++;
+  if (s < e) neg = isneg(&s);
+  for (; s < e && lisdigit(cast_uchar(*s)); s++, any = 1) {
+    if (w != 0 || *s != '0') {  /* significant digit? */
+      if (++nd > 19) return NULL;
+      w = w * 10 + (*s - '0');
+    }
+  }
+  if (s < e && (*s == '.' || *s == dot)) {
+    for (s++; s < e && lisdigit(cast_uchar(*s)); s++, any = 1) {
+      if (w != 0 || *s != '0') {
+        if (++nd > 19) return NULL;
+        w = w * 10 + (*s - '0');
+      }
+      q--;
+    }
+  }
+  if (!any) return NULL;
+  if (s < e && (*s == 'e' || *s == 'E')) {
+    int x = 0;
+    int neg1;
+    s++;  /* skip 'e' */
+    neg1 = (s < e) ? isneg(&s) : 0;
+    if (!(s < e && lisdigit(cast_uchar(*s))))
+      return NULL;  /* let 'lua_str2number' reject it */
+    for (; s < e && lisdigit(cast_uchar(*s)); s++)
+      if (x < 10000) x = x * 10 + (*s - '0');  /* (saturate) */
+    q += (neg1) ? -x : x;
+  }
+  while (s < e && lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+  if (s != e) return NULL;
+  if (w == 0)
+    *result = 0;
+  else if (!diystrtod(w, nd, q, result))
+    return NULL;
+  if (neg) *result = -*result;
+  return s;
+}
 
-static const char *l_str2dloc (const char *s, lua_Number *result, int mode) {
+#endif			/* } */
+
+
+static const char *l_str2dloc (const char *s, const char *e,
+                               lua_Number *result, int mode) {
   char *endptr;
   *result = (mode == 'x') ? lua_strx2number(s, &endptr)  /* try to convert */
                           : lua_str2number(s, &endptr);
   if (endptr == s) return NULL;  /* nothing recognized? */
   while (lisspace(cast_uchar(*endptr))) endptr++;  /* skip trailing spaces */
-  return (*endptr == '\0') ? endptr : NULL;  /* OK if no trailing characters */
+  return (endptr == e) ? endptr : NULL;  /* OK if no trailing characters */
 }
 
 
 /*
-** Convert string 's' to a Lua number (put in 'result'). Return NULL
-** on fail or the address of the ending '\0' on success.
+** Convert the 'len' bytes at 's' to a Lua number (put in 'result').
+** Return NULL on fail or the address of the end on success. 's[len]'
+** must be readable; if it is not a '\0' (a slice), the numeral is
+** copied to a buffer when it must go through 'lua_str2number'.
+** Plain decimal numerals usually go through 'l_str2dfast'. Otherwise,
 ** 'pmode' points to (and 'mode' contains) special things in the string:
 ** - 'x'/'X' means an hexadecimal numeral
 ** - 'n'/'N' means 'inf' or 'nan' (which should be rejected)
@@ -272,21 +549,36 @@ static const char *l_str2dloc (const char *s, lua_Number *result, int mode) {
 ** to a buffer (because 's' is read-only), changes the dot to the
 ** current locale radix mark, and tries to convert again.
 */
-static const char *l_str2d (const char *s, lua_Number *result) {
+static const char *l_str2d (const char *s, size_t len, lua_Number *result) {
   const char *endptr;
-  const char *pmode = strpbrk(s, ".xXnN");
-  int mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
+  const char *pmode;
+  int mode;
+#if defined(DIYFP)
+  if ((endptr = l_str2dfast(s, s + len, result)) != NULL)
+    return endptr;
+#endif
+  if (s[len] != '\0') {  /* not terminated? */
+    char buff[L_MAXLENNUM + 1];
+    if (len > L_MAXLENNUM)
+      return NULL;  /* string too long; fail */
+    memcpy(buff, s, len * sizeof(char));
+    buff[len] = '\0';
+    endptr = l_str2d(buff, len, result);
+    return (endptr != NULL) ? s + (endptr - buff) : NULL;
+  }
+  pmode = strpbrk(s, ".xXnN");
+  mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
   if (mode == 'n')  /* reject 'inf' and 'nan' */
     return NULL;
-  endptr = l_str2dloc(s, result, mode);  /* try to convert */
+  endptr = l_str2dloc(s, s + len, result, mode);  /* try to convert */
   if (endptr == NULL) {  /* failed? may be a different locale */
     char buff[L_MAXLENNUM + 1];
     const char *pdot = strchr(s, '.');
-    if (strlen(s) > L_MAXLENNUM || pdot == NULL)
+    if (len > L_MAXLENNUM || pdot == NULL)
       return NULL;  /* string too long or no dot; fail */
-    strcpy(buff, s);  /* copy string to buffer */
+    memcpy(buff, s, (len + 1) * sizeof(char));  /* copy string to buffer */
     buff[pdot - s] = lua_getlocaledecpoint();  /* correct decimal point */
-    endptr = l_str2dloc(buff, result, mode);  /* try again */
+    endptr = l_str2dloc(buff, buff + len, result, mode);  /* try again */
     if (endptr != NULL)
       endptr = s + (endptr - buff);  /* make relative to 's' */
   }
@@ -297,22 +589,35 @@ static const char *l_str2d (const char *s, lua_Number *result) {
 #define MAXBY10		cast(lua_Unsigned, LUA_MAXINTEGER / 10)
 #define MAXLASTD	cast_int(LUA_MAXINTEGER % 10)
 
-static const char *l_str2int (const char *s, lua_Integer *result) {
+/* largest accumulator that can take 8 more digits without overflow */
+#define MAXBY1E8	cast(lua_Unsigned, (LUA_MAXINTEGER - 99999999) / 100000000)
+
+static const char *l_str2int (const char *s, const char *e,
+                              lua_Integer *result) {
   lua_Unsigned a = 0;
   int empty = 1;
-  int neg;
-  while (lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
-  neg = isneg(&s);
-  if (s[0] == '0' &&
+  int neg = 0;
+  while (s < e && lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
+  if (s < e) neg = isneg(&s);
+  if (e - s >= 2 && s[0] == '0' &&
       (s[1] == 'x' || s[1] == 'X')) {  /* hex? */
     s += 2;  /* skip '0x' */
-    for (; lisxdigit(cast_uchar(*s)); s++) {
+    for (; s < e && lisxdigit(cast_uchar(*s)); s++) {
       a = a * 16 + luaO_hexavalue(*s);
       empty = 0;
     }
   }
   else {  /* decimal */
-    for (; lisdigit(cast_uchar(*s)); s++) {
+#if defined(SWARDIGITS)
+    while (e - s >= 8 && a <= MAXBY1E8) {  /* 8 digits at a time */
+      DWord w = readword8(s);
+      if (!isdigits8(w)) break;
+      a = a * 100000000 + digits8(w);
+      s += 8;
+      empty = 0;
+    }
+#endif
+    for (; s < e && lisdigit(cast_uchar(*s)); s++) {
       int d = *s - '0';
       if (a >= MAXBY10 && (a > MAXBY10 || d > MAXLASTD + neg))  /* overflow? */
         return NULL;  /* do not accept it (as integer) */
@@ -320,8 +625,8 @@ static const char *l_str2int (const char *s, lua_Integer *result) {
       empty = 0;
     }
   }
-  while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
-  if (empty || *s != '\0') return NULL;  /* something wrong in the numeral */
+  while (s < e && lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+  if (empty || s != e) return NULL;  /* something wrong in the numeral */
   else {
     *result = l_castU2S((neg) ? 0u - a : a);
     return s;
@@ -329,18 +634,27 @@ static const char *l_str2int (const char *s, lua_Integer *result) {
 }
 
 
-size_t luaO_str2num (const char *s, TValue *o) {
+/*
+** Convert the 'len' bytes at 's' (see 'l_str2d') to a number in 'o';
+** return 0 if they are not a numeral.
+*/
+int luaO_str2numl (const char *s, size_t len, TValue *o) {
   lua_Integer i; lua_Number n;
-  const char *e;
-  if ((e = l_str2int(s, &i)) != NULL) {  /* try as an integer */
+  if (l_str2int(s, s + len, &i) != NULL) {  /* try as an integer */
     setivalue(o, i);
   }
-  else if ((e = l_str2d(s, &n)) != NULL) {  /* else try as a float */
+  else if (l_str2d(s, len, &n) != NULL) {  /* else try as a float */
     setfltvalue(o, n);
   }
   else
     return 0;  /* conversion failed */
-  return (e - s) + 1;  /* success; return string size */
+  return 1;
+}
+
+
+size_t luaO_str2num (const char *s, TValue *o) {
+  size_t len = strlen(s);
+  return (luaO_str2numl(s, len, o)) ? len + 1 : 0;  /* string size */
 }
 
 
@@ -362,31 +676,328 @@ int luaO_utf8esc (char *buff, unsigned long x) {
 }
 
 
+/*
+** {==================================================================
+** Number to string
+** ===================================================================
+*/
+
 /* maximum length of the conversion of a number to a string */
-#define MAXNUMBER2STR	50
+#define MAXNUMBER2STR	LUA_N2SBUFFSZ
+
+
+/* the pairs "00" to "99", so that integers need one division per pair */
+static const char digitpairs[] =
+  "00010203040506070809101112131415161718192021222324"
+  "25262728293031323334353637383940414243444546474849"
+  "50515253545556575859606162636465666768697071727374"
+  "75767778798081828384858687888990919293949596979899";
 
 
 /*
-** Convert a number object to a string
+** Write integer 'n' in decimal into 'buff'; return its length. The
+** digits are produced backwards, two at a time, in a local buffer.
 */
-void luaO_tostring (lua_State *L, StkId obj) {
+static int tostringint (char *buff, lua_Integer n) {
+  char temp[MAXNUMBER2STR];
+  char *p = temp + sizeof(temp);
+  lua_Unsigned u = l_castS2U(n);
+  int len;
+  if (n < 0) u = 0u - u;
+  while (u >= 100) {
+    int i = cast_int(u % 100) * 2;
+    u /= 100;
+    p -= 2;
+    p[0] = digitpairs[i]; p[1] = digitpairs[i + 1];
+  }
+  if (u >= 10) {
+    int i = cast_int(u) * 2;
+    p -= 2;
+    p[0] = digitpairs[i]; p[1] = digitpairs[i + 1];
+  }
+  else
+    *--p = cast(char, '0' + cast_int(u));
+  if (n < 0)
+    *--p = '-';
+  len = cast_int(temp + sizeof(temp) - p);
+  memcpy(buff, p, len);
+  buff[len] = '\0';
+  return len;
+}
+
+
+/*
+** Floats are written with the shortest digits that read back as the
+** same value, when 'lua_Number' is an IEEE double. They come from
+** Grisu3 (by Florian Loitsch), which rejects the few values (about
+** 1%) for which its approximate arithmetic cannot prove the result
+** shortest; those get their digits from 'l_sprintf' instead.
+** Otherwise, or with LUA_COMPAT_NUMFORMAT, floats use 'lua_number2str'
+** (LUA_NUMBER_FMT).
+*/
+#if defined(DIYFP) && !defined(LUA_COMPAT_NUMFORMAT)	/* { */
+
+/*
+** Cached power 10^-k that brings a number with binary exponent 'e'
+** to the range [2^-60, 2^-32] (times 2^64); '*dk' gets k.
+*/
+static DiyFp cachedpower (int e, int *dk) {
+  double k = (-61 - e) * 0.30102999566398114 + 347;  /* log10(2) */
+  int ik = cast_int(k);
+  int i;
+  DiyFp r;
+  if (ik != k) ik++;  /* ceil */
+  i = (ik >> 3) + 1;
+  *dk = 348 - i * 8;
+  r.f = cachedpow[i].f;
+  r.e = cachedpow[i].e;
+  return r;
+}
+
+
+/*
+** Move the last digit towards 'w' while it stays inside the interval
+** and gets closer to 'w'. 'wpw' (the distance from 'w' to the top of
+** the interval) and the interval itself are known only within 'unit',
+** so the result may not be the closest or may even be outside the
+** exact interval; return 0 when that cannot be ruled out.
+*/
+static int grisuweed (char *digits, int len, DWord delta, DWord rest,
+                      DWord tenk, DWord wpw, DWord unit) {
+  DWord small = wpw - unit;  /* 'w' is at least this far from the top */
+  DWord big = wpw + unit;  /* and at most this far */
+  while (rest < small && delta - rest >= tenk &&
+         (rest + tenk < small || small - rest >= rest + tenk - small)) {
+    digits[len - 1]--;
+    rest += tenk;
+  }
+  if (rest < big && delta - rest >= tenk &&
+      (rest + tenk < big || big - rest > rest + tenk - big))
+    return 0;  /* next lower digit may be closer to the real 'w' */
+  return (2 * unit <= rest && rest <= delta - 4 * unit);
+}
+
+
+/*
+** Generate the digits of 'wp', the top of the interval, until they
+** fall within 'delta' of it; adjust the decimal exponent '*dk' and
+** return the number of digits, or 0 if they may not be the shortest.
+*/
+static int digitgen (DiyFp w, DiyFp wp, DWord delta, char *digits,
+                     int *dk) {
+  int sh = -wp.e;
+  DWord one = 1ULL << sh;
+  DWord wpw = wp.f - w.f;
+  DWord unit = 1;  /* error of the boundaries */
+  unsigned int p1 = cast(unsigned int, wp.f >> sh);  /* integer part */
+  DWord p2 = wp.f & (one - 1);  /* fractional part */
+  int kappa = 1;
+  int len = 0;
+  while (kappa < 10 && p1 >= powten[kappa]) kappa++;
+  while (kappa > 0) {
+    unsigned int d = cast(unsigned int, p1 / powten[kappa - 1]);
+    DWord rest;
+    p1 = cast(unsigned int, p1 % powten[kappa - 1]);
+    if (d || len) digits[len++] = cast(char, '0' + d);
+    kappa--;
+    rest = (cast(DWord, p1) << sh) + p2;
+    if (rest < delta) {
+      *dk += kappa;
+      return grisuweed(digits, len, delta, rest, powten[kappa] << sh,
+                       wpw, unit) ? len : 0;
+    }
+  }
+  for (;;) {  /* kappa <= 0 */
+    char d;
+    p2 *= 10;
+    delta *= 10;
+    unit *= 10;
+    d = cast(char, p2 >> sh);
+    if (d || len) digits[len++] = cast(char, '0' + d);
+    p2 &= one - 1;
+    kappa--;
+    if (p2 < delta) {
+      *dk += kappa;
+      return grisuweed(digits, len, delta, p2, one, wpw * unit, unit) ?
+             len : 0;
+    }
+  }
+}
+
+
+/*
+** Shortest digits of the positive finite 'x': on return,
+** x == digits * 10^(*dk). Return the number of digits, or 0 if
+** Grisu3 cannot tell them.
+*/
+static int grisu3 (double x, char *digits, int *dk) {
+  DWord bits, m;
+  int be;
+  DiyFp w, wp, wm, c;
+  memcpy(&bits, &x, sizeof(bits));
+  be = cast_int(bits >> 52) & 0x7FF;
+  m = bits & ((1ULL << 52) - 1);
+  if (be != 0) { w.f = m | (1ULL << 52); w.e = be - 1075; }
+  else { w.f = m; w.e = -1074; }  /* subnormal */
+  /* boundaries: halfway to the neighbors of 'x' */
+  wp.f = (w.f << 1) + 1; wp.e = w.e - 1;
+  wp = diynormalize(wp);
+  if (m == 0 && be > 1) {  /* lower neighbor is closer? */
+    wm.f = (w.f << 2) - 1; wm.e = w.e - 2;
+  }
+  else {
+    wm.f = (w.f << 1) - 1; wm.e = w.e - 1;
+  }
+  wm.f <<= wm.e - wp.e;
+  wm.e = wp.e;
+  c = cachedpower(wp.e, dk);
+  w = diymul(diynormalize(w), c);
+  wp = diymul(wp, c);
+  wm = diymul(wm, c);
+  wm.f--; wp.f++;  /* products are off by up to one unit */
+  return digitgen(w, wp, wp.f - wm.f, digits, dk);
+}
+
+
+/* write 'x' with 'p' digits ('%.{p-1}e'); return true if it reads back */
+static int fmtdigits (char *buff, double x, int p) {
+  char fmt[] = "%.00e";
+  fmt[2] = cast(char, '0' + (p - 1) / 10);
+  fmt[3] = cast(char, '0' + (p - 1) % 10);
+  l_sprintf(buff, MAXNUMBER2STR, fmt, x);
+  return (lua_str2number(buff, NULL) == x);
+}
+
+
+/*
+** Shortest digits of the positive finite 'x' the slow way, with the
+** (correctly rounded) output of '%e': 17 digits always read back; try
+** fewer until they do not. (If the nearest number with 'p' digits is
+** not 'x' once read, no shorter one is.)
+*/
+static int exactdigits (double x, char *digits, int *dk) {
   char buff[MAXNUMBER2STR];
-  size_t len;
+  const char *s;
+  int n, p = 17;
+  while (p > 1 && fmtdigits(buff, x, p - 1))
+    p--;
+  fmtdigits(buff, x, p);  /* write the shortest again */
+  digits[0] = buff[0];  /* d.ddde+xx */
+  for (n = 1, s = buff + 2; n < p; s++)  /* skip the decimal point */
+    digits[n++] = *s;
+  s = strchr(buff, 'e');
+  *dk = cast_int(strtol(s + 1, NULL, 10)) - (n - 1);
+  return n;
+}
+
+
+/*
+** Write float 'x' with its shortest digits, in positional notation
+** when its decimal exponent is in [-4, 16) and in scientific notation
+** otherwise; return the length. Zero, inf, and NaN use
+** 'lua_number2str'.
+*/
+static int tostringflt (char *buff, lua_Number x) {
+  char digits[24];
+  int len = 0;
+  int n, dk, decpt;
+  if (x == 0 || x - x != 0)  /* zero, inf, or NaN? */
+    return lua_number2str(buff, MAXNUMBER2STR, x);
+  if (x < 0) {
+    buff[len++] = '-';
+    x = -x;
+  }
+  n = grisu3(x, digits, &dk);
+  if (n == 0)  /* Grisu3 cannot decide? */
+    n = exactdigits(x, digits, &dk);
+  decpt = n + dk;  /* x == 0.digits * 10^decpt */
+  if (-4 < decpt && decpt <= 16) {
+    if (decpt <= 0) {  /* 0.000ddd */
+      buff[len++] = '0';
+      buff[len++] = lua_getlocaledecpoint();
+      memset(buff + len, '0', -decpt);
+      len += -decpt;
+      memcpy(buff + len, digits, n);
+      len += n;
+    }
+    else if (decpt < n) {  /* ddd.ddd */
+      memcpy(buff + len, digits, decpt);
+      len += decpt;
+      buff[len++] = lua_getlocaledecpoint();
+      memcpy(buff + len, digits + decpt, n - decpt);
+      len += n - decpt;
+    }
+    else {  /* ddd000 */
+      memcpy(buff + len, digits, n);
+      len += n;
+      memset(buff + len, '0', decpt - n);
+      len += decpt - n;
+    }
+  }
+  else {  /* d.ddde+xx, as '%g' writes it */
+    int e = decpt - 1;
+    buff[len++] = digits[0];
+    if (n > 1) {
+      buff[len++] = lua_getlocaledecpoint();
+      memcpy(buff + len, digits + 1, n - 1);
+      len += n - 1;
+    }
+    buff[len++] = 'e';
+    if (e < 0) { buff[len++] = '-'; e = -e; }
+    else buff[len++] = '+';
+    if (e >= 100) {
+      buff[len++] = cast(char, '0' + e / 100);
+      e %= 100;
+    }
+    buff[len++] = digitpairs[e * 2];
+    buff[len++] = digitpairs[e * 2 + 1];
+  }
+  buff[len] = '\0';
+  return len;
+}
+
+#else						/* }{ */
+
+#define tostringflt(buff,x)	lua_number2str(buff, MAXNUMBER2STR, x)
+
+#endif						/* } */
+
+
+/*
+** Convert a number object to a string in 'buff', which must have
+** MAXNUMBER2STR bytes; return the length of the result (not counting
+** the '\0' at its end).
+*/
+int luaO_tostringbuff (const TValue *obj, char *buff) {
+  int len;
   lua_assert(ttisnumber(obj));
   if (ttisinteger(obj))
-    len = lua_integer2str(buff, sizeof(buff), ivalue(obj));
+    len = tostringint(buff, ivalue(obj));
   else {
-    len = lua_number2str(buff, sizeof(buff), fltvalue(obj));
+    len = tostringflt(buff, fltvalue(obj));
 #if !defined(LUA_COMPAT_FLOATSTRING)
     if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
       buff[len++] = lua_getlocaledecpoint();
       buff[len++] = '0';  /* adds '.0' to result */
+      buff[len] = '\0';
     }
 #endif
   }
+  return len;
+}
+
+
+/*
+** Convert a number object to a string
+*/
+void luaO_tostring (lua_State *L, StkId obj) {
+  char buff[MAXNUMBER2STR];
+  int len = luaO_tostringbuff(obj, buff);
   setsvalue2s(L, obj, luaS_newlstr(L, buff, len));
 }
 
+/* }================================================================== */
+
 
 static void pushstr (lua_State *L, const char *str, size_t l) {
   setsvalue2s(L, L->top, luaS_newlstr(L, str, l));
@@ -109,7 +109,11 @@ typedef union Value {
 } Value;
 
 
+#if defined(LUA_COMPACTNODES)
+#define TValuefields	Value value_; lu_byte tt_
+#else
 #define TValuefields	Value value_; int tt_
+#endif
 
 
 typedef struct lua_TValue {
@@ -259,7 +263,8 @@ typedef struct lua_TValue {
 
 
 #define setobj(L,obj1,obj2) \
-	{ TValue *io1=(obj1); *io1 = *(obj2); \
+	{ TValue *io1=(obj1); const TValue *io2=(obj2); \
+	  io1->value_ = io2->value_; io1->tt_ = io2->tt_; \
 	  (void)L; checkliveness(L,io1); }
 
 
@@ -281,7 +286,8 @@ typedef struct lua_TValue {
 #define setsvalue2n	setsvalue
 
 /* to table (define it as an expression to be used in macros) */
-#define setobj2t(L,o1,o2)  ((void)L, *(o1)=*(o2), checkliveness(L,(o1)))
+#define setobj2t(L,o1,o2)  ((void)L, (o1)->value_ = (o2)->value_, \
+	(o1)->tt_ = (o2)->tt_, checkliveness(L,(o1)))
 
 
 
@@ -304,7 +310,7 @@ typedef TValue *StkId;  /* index to stack elements */  //一个指针啊
 */
 typedef struct TString {
   CommonHeader;
-  lu_byte extra;  /* reserved words for short strings; "has hash" for longs */ // 用来记录辅助信息,对于短字符串 extra 用来记录这个字符串是否为保留字，这个标记用于词法分析器对保留字的快速判断；对于长字符串，可以用于惰性求哈希值。
+  lu_byte extra;  /* reserved words for short strings; "has hash" (and STRSLICE) for longs */ // 用来记录辅助信息,对于短字符串 extra 用来记录这个字符串是否为保留字，这个标记用于词法分析器对保留字的快速判断；对于长字符串，可以用于惰性求哈希值。
   lu_byte shrlen;  /* length for short strings */  // lua不依靠 \0 作为结尾,所以需要 len 域来记录其长度
   unsigned int hash;
   union {
@@ -323,13 +329,62 @@ typedef union UTString {
 } UTString;
 
 
+/*
+** A slice is a long string whose bytes are inside another string, its
+** 'parent', instead of after its header (see 'luaS_newslice'). Once it
+** needs its own zero-terminated copy ('luaS_materialize'), the bytes
+** are in a separate block and 'parent' is NULL. Slices are marked by
+** bit STRSLICE in 'extra' (reserved words never get that high).
+*/
+typedef struct StrSlice {
+  char *data;  /* contents of the slice */
+  struct TString *parent;  /* string holding them (or NULL) */
+} StrSlice;
+
+#define STRSLICE	0x80
+
+#define isslice(ts)	((ts)->extra & STRSLICE)
+
+#define getslice(ts)	cast(StrSlice *, cast(char *, (ts)) + sizeof(UTString))
+
+
+/*
+** An external string is a slice without parent whose bytes belong to
+** the program (see 'lua_pushexternalstring'); they are released with
+** 'falloc' when the string is collected. External strings are marked
+** by bits STRSLICE and STREXTERNAL in 'extra'.
+*/
+typedef struct ExtString {
+  StrSlice sl;
+  lua_Alloc falloc;  /* function to release the contents (or NULL) */
+  void *ud;  /* auxiliary data to 'falloc' */
+} ExtString;
+
+#define STREXTERNAL	0x40
+
+#define isexternal(ts)	((ts)->extra & STREXTERNAL)
+
+#define getextstr(ts)	cast(ExtString *, getslice(ts))
+
+
+/*
+** Bit STRINTERNED in 'extra' marks interned long strings (medium
+** strings, see 'internmedstr'): two of them are equal only if they are
+** the same object.
+*/
+#define STRINTERNED	0x20
+
+#define isinterned(ts)	((ts)->extra & STRINTERNED)
+
+
 /*
 ** Get the actual string (array of bytes) from a 'TString'.
 ** (Access to 'extra' ensures that value is really a 'TString'.)
 */
 // 字符串的数据内容并没有被分配独立一块内存来保存，而是直接最加在 TString 结构的后面。 用 getstr 这个宏就可以取到实际的 C 字符串指针。
 #define getstr(ts)  \
-  check_exp(sizeof((ts)->extra), cast(char *, (ts)) + sizeof(UTString))
+  check_exp(sizeof((ts)->extra), isslice(ts) ? getslice(ts)->data \
+                                  : cast(char *, (ts)) + sizeof(UTString))
 
 
 /* get the actual string (array of bytes) from a Lua value */
@@ -480,6 +535,29 @@ typedef union Closure {
 ** Tables
 */
 
+#if defined(LUA_COMPACTNODES)
+
+/*
+** Nodes for Hash tables: A pack of two TValue's (key-value pairs)
+** plus a 'next' field to link colliding entries. The key tag and
+** 'next' live in the padding after the value tag, so the key is kept
+** as a bare 'Value'.
+*/
+typedef union Node {
+  struct NodeKey {
+    TValuefields;  /* fields for value */
+    lu_byte key_tt;  /* key type */
+    int next;  /* for chaining (offset for next node) */
+    Value key_val;  /* key value */
+  } u;
+  TValue i_val;  /* direct access to node's value as a proper 'TValue' */
+} Node;
+
+#define keytt(node)		((node)->u.key_tt)
+#define keyval(node)		((node)->u.key_val)
+
+#else
+
 typedef union TKey {
   struct {
     TValuefields;
@@ -489,19 +567,47 @@ typedef union TKey {
 } TKey;
 
 
-/* copy a value into a key without messing up field 'next' */
-#define setnodekey(L,key,obj) \
-	{ TKey *k_=(key); const TValue *io_=(obj); \
-	  k_->nk.value_ = io_->value_; k_->nk.tt_ = io_->tt_; \
-	  (void)L; checkliveness(L,io_); }
-
-
 // Tkey比 TValue 多了 一个 int next 字段
 typedef struct Node {
   TValue i_val;
   TKey i_key;
 } Node;
 
+#define keytt(node)		((node)->i_key.nk.tt_)
+#define keyval(node)		((node)->i_key.nk.value_)
+
+#endif
+
+
+/* copy a value into a key without messing up field 'next' */
+#define setnodekey(L,node,obj) \
+	{ Node *n_=(node); const TValue *io_=(obj); \
+	  keyval(n_) = io_->value_; keytt(n_) = io_->tt_; \
+	  (void)L; checkliveness(L,io_); }
+
+
+/* copy a key into a value */
+#define getnodekey(L,obj,node) \
+	{ TValue *io_=(obj); const Node *n_=(node); \
+	  io_->value_ = keyval(n_); io_->tt_ = keytt(n_); \
+	  (void)L; checkliveness(L,io_); }
+
+
+/* access to the key of a node */
+#define keyisnil(node)		(keytt(node) == LUA_TNIL)
+#define keyisinteger(node)	(keytt(node) == LUA_TNUMINT)
+#define keyival(node)		(keyval(node).i)
+#define keyisshrstr(node)	(keytt(node) == ctb(LUA_TSHRSTR))
+#define keyislngstr(node)	(keytt(node) == ctb(LUA_TLNGSTR))
+#define keystrval(node)		(gco2ts(keyval(node).gc))
+#define keyisdead(node)		(keytt(node) == LUA_TDEADKEY)
+#define keyiscollectable(node)	(keytt(node) & BIT_ISCOLLECTABLE)
+#define gckey(node)		(keyval(node).gc)
+#define gckeyN(node)	(keyiscollectable(node) ? gckey(node) : NULL)
+
+#define setnilkey(node)		(keytt(node) = LUA_TNIL)
+#define setdeadkey(node)	(keytt(node) = LUA_TDEADKEY)
+
 /*
  *每个 table 结构，最多会由三块连续内存构成。 一个 Table 结构，一块存放了连续整数索引的数组，和 一块大小为 2 的整数次幂的哈希表。
  */
@@ -548,8 +654,15 @@ LUAI_FUNC int luaO_utf8esc (char *buff, unsigned long x);
 LUAI_FUNC int luaO_ceillog2 (unsigned int x);
 LUAI_FUNC void luaO_arith (lua_State *L, int op, const TValue *p1,
                            const TValue *p2, TValue *res);
+/* maximum length of a numeral */
+#if !defined (L_MAXLENNUM)
+#define L_MAXLENNUM	200
+#endif
+
 LUAI_FUNC size_t luaO_str2num (const char *s, TValue *o);
+LUAI_FUNC int luaO_str2numl (const char *s, size_t len, TValue *o);
 LUAI_FUNC int luaO_hexavalue (int c);
+LUAI_FUNC int luaO_tostringbuff (const TValue *obj, char *buff);
 LUAI_FUNC void luaO_tostring (lua_State *L, StkId obj);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
@@ -366,6 +366,8 @@ static int os_setlocale (lua_State *L) {
   const char *l = luaL_optstring(L, 1, NULL);
   int op = luaL_checkoption(L, 2, "all", catnames);
   lua_pushstring(L, setlocale(cat[op], l));
+  if (l != NULL && (cat[op] == LC_ALL || cat[op] == LC_COLLATE))
+    luaL_setcollate(L);  /* collation may have changed */
   return 1;
 }
 
@@ -36,6 +36,14 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation GC的运行速度是内存分配速度的两倍 */
 #endif
 
+#if !defined(LUAI_GCOVERHEAD)
+#define LUAI_GCOVERHEAD	100  /* pacer lets heap grow to twice live data */
+#endif
+
+#if !defined(LUAI_GENMINORMUL)
+#define LUAI_GENMINORMUL	20  /* minor collection after 20% growth */
+#endif
+
 
 /*
 ** a macro to help the creation of a unique random seed when a state is
@@ -108,7 +116,7 @@ void luaE_setdebt (global_State *g, l_mem debt) {
 
 
 CallInfo *luaE_extendCI (lua_State *L) {
-  CallInfo *ci = luaM_new(L, CallInfo);
+  CallInfo *ci = luaM_newfixed(L, CallInfo);
   lua_assert(L->ci->next == NULL);
   L->ci->next = ci;
   ci->previous = L->ci;
@@ -127,7 +135,7 @@ void luaE_freeCI (lua_State *L) {
   ci->next = NULL;
   while ((ci = next) != NULL) {
     next = ci->next;
-    luaM_free(L, ci);
+    luaM_freefixed(L, ci);
     L->nci--;
   }
 }
@@ -141,7 +149,7 @@ void luaE_shrinkCI (lua_State *L) {
   CallInfo *next2;  /* next's next */
   /* while there are two nexts */
   while (ci->next != NULL && (next2 = ci->next->next) != NULL) {
-    luaM_free(L, ci->next);  /* free next */
+    luaM_freefixed(L, ci->next);  /* free next */
     L->nci--;
     ci->next = next2;  /* remove 'next' from the list */
     next2->previous = ci;
@@ -195,6 +203,9 @@ static void init_registry (lua_State *L, global_State *g) {
   /* registry[LUA_RIDX_GLOBALS] = table of globals */
   sethvalue(L, &temp, luaH_new(L));  /* temp = new table (global table) */
   luaH_setint(L, registry, LUA_RIDX_GLOBALS, &temp);
+  /* registry[LUA_RIDX_KEYS] = table anchoring interned keys */
+  sethvalue(L, &temp, luaH_new(L));
+  luaH_setint(L, registry, LUA_RIDX_KEYS, &temp);
 }
 
 
@@ -245,12 +256,17 @@ static void preinit_thread (lua_State *L, global_State *g) {
 
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  luaG_freeprofile(L);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeallobjects(L);  /* collect all objects */
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  luaM_freearray(L, G(L)->strt.oldhash, G(L)->strt.oldsize);
+  luaM_freearray(L, G(L)->medt.hash, G(L)->medt.size);
+  luaM_freearray(L, G(L)->strcache, G(L)->strcachesize * STRCACHE_M);
   freestack(L);
+  luaM_freeslabs(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
@@ -292,7 +308,7 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
   freestack(L1);
-  luaM_free(L, l);
+  luaM_freefixed(L, l);
 }
 
 
@@ -317,12 +333,33 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->GCestimate = 0;
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->strt.oldhash = NULL;
+  g->strt.oldsize = g->strt.migrated = 0;
+  g->medt.hash = NULL;
+  g->medt.nuse = g->medt.ndead = g->medt.size = 0;
+  g->internlen = LUAI_INTERNLEN;
+  g->bytecollate = 0;
+  g->strcache = NULL;
+  g->strcachesize = g->strcachewin = 0;
+  g->strcachehits = g->strcachemisses = g->strcachemark = 0;
+  for (i = 0; i < SLABCLASSES; i++) {
+    g->slabs[i].freelist = NULL;
+    g->slabs[i].slabs = NULL;
+    g->slabs[i].nfree = 0;
+    g->slabs[i].nslabs = 0;
+  }
   setnilvalue(&g->l_registry);
   g->panic = NULL;
+  g->nextf = NULL;
   g->version = NULL;
   g->gcstate = GCSpause;
-  g->gckind = KGC_NORMAL;
+  g->gckind = KGC_INC;
+  g->gcemergency = 0;
+  g->gcparallel = 0;
+  g->gcfreeing = 0;
   g->allgc = g->finobj = g->tobefnz = g->fixedgc = NULL;
+  g->survival = g->old = g->reallyold = NULL;
+  g->finobjsur = g->finobjold = g->finobjrold = NULL;
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
@@ -332,6 +369,28 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->genminormul = LUAI_GENMINORMUL;
+  g->gcworkers = NULL;
+  g->gcsweeper = NULL;
+  g->ephindex = NULL;
+  g->gcmaxpause = 0;
+  g->gcoverhead = LUAI_GCOVERHEAD;
+  g->gcpacemul = LUAI_GCMUL;
+  g->gcbacklog = g->gcthreshold = 0;
+  g->gcpeak = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  memset(&g->gclaststats, 0, sizeof(g->gclaststats));
+  g->gchook = NULL;
+  g->gchookud = NULL;
+  g->gcphasestart = g->gcstepstart = 0;
+  g->gcphase = GCSpause;
+  g->allocsample = MAX_LMEM;  /* profiler is off */
+  g->allocprof = NULL;
+  g->memcheck = MAX_LUMEM;  /* no limits */
+  g->memsoft = g->memhard = 0;
+  g->memhook = NULL;
+  g->memhookud = NULL;
+  g->memsoftfired = 0;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
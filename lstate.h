@@ -69,6 +69,13 @@ g->grayagain 的用途：
 ** 'ephemeron': ephemeron tables with white->white entries;   ephemeron 声明极短暂的
 ** 'allweak': tables with weak keys and/or weak values to be cleared.
 ** The last three lists are used only during the atomic phase.
+**
+** In generational mode, lists 'allgc' and 'finobj' are split by
+** pointers 'survival'/'old'/'reallyold' (and their 'finobj*'
+** counterparts) into segments of new, survival, old, and really old
+** objects. Between collections, 'grayagain' keeps all old threads and
+** the old tables touched by a write barrier (the remembered set);
+** those tables may be black while in that list.
 
 此外，还有另一组控制灰色对象的列表。这些列表由“gclist”字段链接。 
 （所有可以变成灰色的对象都有这样一个字段，这个字段在所有对象中不一样，但它总是有一个名字。）
@@ -97,17 +104,46 @@ struct lua_longjmp;  /* defined in ldo.c */
 
 
 /* kinds of Garbage Collection */
-#define KGC_NORMAL	0
-#define KGC_EMERGENCY	1	/* gc was forced by an allocation failure */
+#define KGC_INC		0	/* incremental gc */
+#define KGC_GEN		1	/* generational gc */
 
 // 存放字符串的hash表.
 typedef struct stringtable {
   TString **hash;  // 二级指针  思考一下这里为什么是二级指针
   int nuse;  /* number of elements */  // 用了多少个坑
   int size;  // 共有多少个坑
+  TString **oldhash;  /* array being migrated into 'hash' (or NULL) */
+  int oldsize;  /* size of 'oldhash' */
+  int migrated;  /* buckets of 'oldhash' already moved to 'hash' */
 } stringtable;
 
 
+/*
+** Table of medium strings (see 'internmedstr'), with open addressing
+** and linear probing. Entries of collected strings become tombstones.
+*/
+typedef struct medtable {
+  TString **hash;
+  int nuse;  /* number of strings */
+  int ndead;  /* number of tombstones */
+  int size;
+} medtable;
+
+
+/*
+** Size classes of the slab allocator (see 'luaM_newobject'): blocks
+** of up to SLABCLASSES * 16 bytes, in steps of 16 bytes.
+*/
+#define SLABCLASSES	16
+
+typedef struct SlabClass {
+  void *freelist;  /* free blocks, linked through their first word */
+  struct Slab *slabs;  /* list of all slabs of this class */
+  lu_mem nfree;  /* number of blocks in 'freelist' */
+  int nslabs;  /* number of slabs in 'slabs' */
+} SlabClass;
+
+
 /*
 ** Information about a call.
 ** When a thread yields, 'func' is adjusted to pretend that the
@@ -176,11 +212,18 @@ typedef struct global_State {
   lu_mem GCmemtrav;  /* memory traversed by the GC */            // GC遍历的内存,已经遍历了多少内存.
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */  // 对正在使用的非垃圾内存的估计
   stringtable strt;  /* hash table for strings */    // 字符串哈希表 string table 短字符串都存放在这个hash表中
+  medtable medt;  /* table of medium strings */
+  size_t internlen;  /* maximum length of interned strings */
+  lu_byte bytecollate;  /* true if strings order by bytes (see 'l_strcmp') */
+  SlabClass slabs[SLABCLASSES];  /* free lists for small objects */
   TValue l_registry;
   unsigned int seed;  /* randomized seed for hashes */  // 散列随机种子
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */  // 垃圾收集器的状态
   lu_byte gckind;  /* kind of GC running */         // gc 运行的种类
+  lu_byte gcemergency;  /* true if this is an emergency collection */
+  lu_byte gcparallel;  /* true in the copies used by marking workers */
+  lu_byte gcfreeing;  /* true while collector frees dead objects */
   lu_byte gcrunning;  /* true if GC is running */  // 标志gc是否在运行
   GCObject *allgc;  /* list of all collectable objects */ // 可回收对象的列表
   GCObject **sweepgc;  /* current position of sweep in list */  // 扫描列表的当前位置
@@ -192,17 +235,58 @@ typedef struct global_State {
   GCObject *allweak;  /* list of all-weak tables */   // 所有的弱键列表
   GCObject *tobefnz;  /* list of userdata to be GC */   // 需要gc的用户数据的列表
   GCObject *fixedgc;  /* list of objects not to be collected */   // 不收集的对象列表
+  /* fields for generational collector */
+  GCObject *survival;  /* start of objects that survived one GC cycle */
+  GCObject *old;  /* start of old objects */
+  GCObject *reallyold;  /* old objects with more than one cycle */
+  GCObject *finobjsur;  /* list of survival objects with finalizers */
+  GCObject *finobjold;  /* list of old objects with finalizers */
+  GCObject *finobjrold;  /* list of really old objects with finalizers */
   struct lua_State *twups;  /* list of threads with open upvalues */   //具有开放上值的线程列表
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */   // 每个GC步骤中要调用的终结器数
   int gcpause;  /* size of pause between successive GCs */  // 连续GCs之间的暂停大小
   int gcstepmul;  /* GC 'granularity' */   // gc粒度
+  int genminormul;  /* control for minor generational collections */
+  struct GCWorkers *gcworkers;  /* threads for parallel marking (or NULL) */
+  struct GCSweeper *gcsweeper;  /* thread releasing dead objects (or NULL) */
+  struct EphIndex *ephindex;  /* index of pending ephemeron entries */
+  /* fields for the latency pacer (see 'pacedstep') */
+  unsigned int gcmaxpause;  /* maximum time per step, in us (0: no pacer) */
+  int gcoverhead;  /* target heap overhead over live data (in %) */
+  int gcpacemul;  /* work multiplier adjusted by the pacer */
+  l_mem gcbacklog;  /* work left undone by steps out of time */
+  l_mem gcthreshold;  /* heap size that started current cycle */
+  lu_mem gcpeak;  /* largest heap size seen in current cycle */
+  /* fields for statistics (see 'phasechange') */
+  lua_GCStats gcstats;  /* statistics of the cycle in progress */
+  lua_GCStats gclaststats;  /* statistics of the last complete cycle */
+  lua_GCHook gchook;  /* called at phase transitions (or NULL) */
+  void *gchookud;  /* auxiliary data to 'gchook' */
+  lu_mem gcphasestart;  /* time when current phase (or step) started */
+  lu_mem gcstepstart;  /* time when current step started */
+  lu_byte gcphase;  /* phase being timed */
+  l_mem allocsample;  /* bytes to allocate until next profiler sample */
+  struct AllocProfile *allocprof;  /* allocation profile (or NULL) */
+  /* fields for memory limits (see 'luaM_setlimits') */
+  lu_mem memcheck;  /* next limit to check (MAX_LUMEM if none) */
+  lu_mem memsoft;  /* soft limit (0 if none) */
+  lu_mem memhard;  /* hard limit (0 if none) */
+  lua_MemHook memhook;  /* called at the limits (or NULL) */
+  void *memhookud;  /* auxiliary data to 'memhook' */
+  lu_byte memsoftfired;  /* soft limit crossed in this cycle? */
   lua_CFunction panic;  /* to be called in unprotected errors */   // 惊恐  在不受保护的错误中调用
+  lua_CFunction nextf;  /* primitive 'next', known to OP_TFORCALL */
   struct lua_State *mainthread;   // 主线程的引用
   const lua_Number *version;  /* pointer to version number */  // 指向版本号的指针
   TString *memerrmsg;  /* memory-error message */   // 内存错误消息 
   TString *tmname[TM_N];  /* array with tag-method names */  // 带有标记方法名称的数组
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */   // 基础类型的元表
-  TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */  // API中字符串的缓存
+  TString **strcache;  /* cache for strings in API (see 'luaS_new') */  // API中字符串的缓存
+  int strcachesize;  /* number of sets in 'strcache' */
+  int strcachewin;  /* misses left in the current window */
+  lu_mem strcachehits;  /* lookups in 'strcache' that found their string */
+  lu_mem strcachemisses;  /* lookups that did not */
+  lu_mem strcachemark;  /* value of 'strcachehits' when the window began */
 } global_State;
 
 
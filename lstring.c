@@ -35,67 +35,241 @@
 
 
 /*
-** equality for long strings
+** equality for long strings. Bit 0 of 'extra' is set only once 'hash'
+** holds 'luaS_hash' of the contents with the state's seed (every long
+** string starts with the seed there), so two strings that both have it
+** and differ in 'hash' cannot be equal; that avoids a 'memcmp' over a
+** common prefix when unequal keys meet in a table chain.
 */
 int luaS_eqlngstr (TString *a, TString *b) {
   size_t len = a->u.lnglen;
   lua_assert(a->tt == LUA_TLNGSTR && b->tt == LUA_TLNGSTR);
   return (a == b) ||  /* same instance or... */
-    ((len == b->u.lnglen) &&  /* equal length and ... */
+    (!(isinterned(a) && isinterned(b)) &&  /* not both interned and ... */
+     (len == b->u.lnglen) &&  /* equal length and ... */
+     !((a->extra & b->extra & 1) && a->hash != b->hash) &&  /* hashes agree */
      (memcmp(getstr(a), getstr(b), len) == 0));  /* equal contents */
 }
 
+/*
+** {======================================================
+** Word-at-a-time hash (LUA_WORDHASH)
+** =======================================================
+*/
+
+#if defined(LUA_WORDHASH) && !defined(luai_hashstring)
+
+#if !defined(LLONG_MAX)
+#error "LUA_WORDHASH needs 'long long'"
+#endif
+
+typedef unsigned long long HWord;  /* (assumed to have 64 bits) */
+
+#define HP1	0x9E3779B185EBCA87ULL
+#define HP2	0xC2B2AE3D27D4EB4FULL
+#define HP3	0x165667B19E3779F9ULL
+#define HP4	0x85EBCA77C2B2AE63ULL
+#define HP5	0x27D4EB2F165667C5ULL
+
+#define rotl(x,n)	(((x) << (n)) | ((x) >> (64 - (n))))
+
+/* read a word in machine order (the copy becomes a single load) */
+static HWord readword (const char *p) {
+  HWord w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+/* read 4 bytes (little-endian) */
+static HWord readhalf (const char *p) {
+  return cast_byte(p[0]) | (cast(HWord, cast_byte(p[1])) << 8) |
+         (cast(HWord, cast_byte(p[2])) << 16) |
+         (cast(HWord, cast_byte(p[3])) << 24);
+}
+
+static HWord hashround (HWord acc, HWord w) {
+  acc += w * HP2;
+  acc = rotl(acc, 31);
+  return acc * HP1;
+}
+
+static HWord mergelane (HWord h, HWord v) {
+  h ^= hashround(0, v);
+  return h * HP1 + HP4;
+}
+
+
+/*
+** Strings of 32 bytes or more go through four independent lanes of 8
+** bytes each, which the compiler can keep in flight (or vectorize);
+** the rest is hashed a word, then half a word, then a byte at a time.
+*/
+static unsigned int wordhash (const char *str, size_t l, unsigned int seed) {
+  const char *p = str;
+  size_t n = l;
+  HWord h;
+  if (n >= 32) {
+    HWord v1 = seed + HP1 + HP2, v2 = seed + HP2;
+    HWord v3 = seed, v4 = seed - HP1;
+    do {
+      v1 = hashround(v1, readword(p));
+      v2 = hashround(v2, readword(p + 8));
+      v3 = hashround(v3, readword(p + 16));
+      v4 = hashround(v4, readword(p + 24));
+      p += 32; n -= 32;
+    } while (n >= 32);
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = mergelane(h, v1); h = mergelane(h, v2);
+    h = mergelane(h, v3); h = mergelane(h, v4);
+  }
+  else
+    h = seed + HP5;
+  h += l;
+  for (; n >= 8; p += 8, n -= 8) {
+    h ^= hashround(0, readword(p));
+    h = rotl(h, 27) * HP1 + HP4;
+  }
+  if (n >= 4) {
+    h ^= readhalf(p) * HP1;
+    h = rotl(h, 23) * HP2 + HP3;
+    p += 4; n -= 4;
+  }
+  for (; n > 0; p++, n--) {
+    h ^= cast_byte(*p) * HP5;
+    h = rotl(h, 11) * HP1;
+  }
+  h ^= h >> 33;  /* final avalanche */
+  h *= HP2;
+  h ^= h >> 29;
+  h *= HP3;
+  h ^= h >> 32;
+  return cast(unsigned int, h);
+}
+
+#define luai_hashstring(s,l,seed)	wordhash(s, l, seed)
+
+#endif
+
+/* }====================================================== */
+
+
 // 获取字符串的哈希值
 unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+#if defined(luai_hashstring)
+  return luai_hashstring(str, l, seed);
+#else
   unsigned int h = seed ^ cast(unsigned int, l);
   size_t step = (l >> LUAI_HASHLIMIT) + 1;
   for (; l >= step; l -= step)
     h ^= ((h<<5) + (h>>2) + cast_byte(str[l - 1]));  // 好熟悉,哈希值左五右2 + 当前字符
   return h;
+#endif
 }
 
 
 unsigned int luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_TLNGSTR);
-  if (ts->extra == 0) {  /* no hash? */
+  if ((ts->extra & 1) == 0) {  /* no hash? */
     ts->hash = luaS_hash(getstr(ts), ts->u.lnglen, ts->hash);
-    ts->extra = 1;  /* now it has its hash */
+    ts->extra |= 1;  /* now it has its hash */
   }
   return ts->hash;
 }
 
 
 /*
-** resizes the string table
+** Number of buckets moved from the old array to the new one in each
+** lookup while the string table grows. The table doubles when full,
+** so the migration ends well before the next growth.
 */
+#if !defined(STRMIGRATE)
+#define STRMIGRATE	2
+#endif
+
+
+/* insert the strings in list 'p' into their buckets in 'hash' */
+static void rehashlist (TString *p, TString **hash, int size) {
+  while (p) {  /* for each node in the list */  // 当哈希冲突时,使用开放链表法,放在同一哈希位的链表上
+    TString *hnext = p->u.hnext;  /* save next */
+    unsigned int h = lmod(p->hash, size);  /* new position */
+    p->u.hnext = hash[h];  /* chain it */ // 这里好巧妙:先链住这个位置的值(如果已经有值的话,否则就是null),然后再将p放到当前位置上.如果该位置已经有值p1,rehash之后,这个位置是p2,p2->u.hnext为p1
+    hash[h] = p;
+    p = hnext;
+  }
+}
+
+
 /*
-**
+** Move up to 'n' buckets of the old array into the new one, freeing
+** the old array once it is empty. Sizes are powers of 2, so the strings
+** of old bucket 'i' go to the new buckets congruent to 'i'; these are
+** only cleared now, keeping the cost of a growth spread too.
+*/
+static void migratestrings (lua_State *L, stringtable *tb, int n) {
+  while (n-- > 0 && tb->migrated < tb->oldsize) {
+    int i = tb->migrated++;
+    int j;
+    for (j = i; j < tb->size; j += tb->oldsize)
+      tb->hash[j] = NULL;
+    rehashlist(tb->oldhash[i], tb->hash, tb->size);
+  }
+  if (tb->migrated == tb->oldsize) {  /* done? */
+    luaM_freearray(L, tb->oldhash, tb->oldsize);
+    tb->oldhash = NULL;
+    tb->oldsize = tb->migrated = 0;
+  }
+}
+
+
+/*
+** Bucket for hash 'h': while the table grows, strings whose old bucket
+** was not migrated yet are still (and new ones go) in the old array.
+*/
+static TString **strbucket (stringtable *tb, unsigned int h) {
+  if (tb->oldhash != NULL) {
+    int i = lmod(h, tb->oldsize);
+    if (i >= tb->migrated)
+      return &tb->oldhash[i];
+  }
+  return &tb->hash[lmod(h, tb->size)];
+}
+
+
+/*
+** resizes the string table. Growing allocates a new bucket array and
+** keeps the old one beside it; 'internshrstr' moves its strings a few
+** buckets at a time, so that a large table does not stall. Shrinking
+** (done by the collector) rehashes in place.
 */
 void luaS_resize (lua_State *L, int newsize) {
   int i;
   stringtable *tb = &G(L)->strt;  
-  if (newsize > tb->size) {  /* grow table if needed */  //如果新的size 超过了 短字符串表的size, 就重新申请大小为new size的空间
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
-    for (i = tb->size; i < newsize; i++)  // 申请完后将内存清空. 这里好像没有清空以前的内存 x  在realloc函数中,如果原地拓展内存失败,会申请一个新的内存,并将原来的内存释放掉.(在堆上)
-      tb->hash[i] = NULL;
-  }
-  for (i = 0; i < tb->size; i++) {  /* rehash */  // 对于数组中的每个元素,
-    TString *p = tb->hash[i];  // 获取短字符串的 hash表
-    tb->hash[i] = NULL;
-    while (p) {  /* for each node in the list */  // 当哈希冲突时,使用开放链表法,放在同一哈希位的链表上
-      TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, newsize);  /* new position */
-      p->u.hnext = tb->hash[h];  /* chain it */ // 这里好巧妙:先链住这个位置的值(如果已经有值的话,否则就是null),然后再将p放到当前位置上.如果该位置已经有值p1,rehash之后,这个位置是p2,p2->u.hnext为p1
-      tb->hash[h] = p;
-      p = hnext;
+  if (tb->oldhash != NULL)  /* previous growth still in progress? */
+    migratestrings(L, tb, tb->oldsize);  /* finish it */
+  if (newsize > tb->size) {  /* grow table if needed */
+    TString **newhash = luaM_newvector(L, newsize, TString *);
+    if (tb->size > 0) {  /* strings to migrate? */
+      lua_assert(newsize % tb->size == 0);
+      tb->oldhash = tb->hash;
+      tb->oldsize = tb->size;
+      tb->migrated = 0;
+    }
+    else {
+      for (i = 0; i < newsize; i++)
+        newhash[i] = NULL;
     }
+    tb->hash = newhash;
+    tb->size = newsize;
   }
-  if (newsize < tb->size) {  /* shrink table if needed */
-    /* vanishing slice should be empty */
-    lua_assert(tb->hash[newsize] == NULL && tb->hash[tb->size - 1] == NULL);
+  else if (newsize < tb->size) {  /* shrink table */
+    for (i = newsize; i < tb->size; i++) {  /* rehash vanishing slice */
+      TString *p = tb->hash[i];
+      tb->hash[i] = NULL;
+      rehashlist(p, tb->hash, newsize);
+    }
     luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
+    tb->size = newsize;
   }
-  tb->size = newsize;
 }
 
 
@@ -104,12 +278,33 @@ void luaS_resize (lua_State *L, int newsize) {
 ** a non-collectable string.)
 */
 void luaS_clearcache (global_State *g) {
-  int i, j;
-  for (i = 0; i < STRCACHE_N; i++)
-    for (j = 0; j < STRCACHE_M; j++) {
-    if (iswhite(g->strcache[i][j]))  /* will entry be collected? */
-      g->strcache[i][j] = g->memerrmsg;  /* replace it with something fixed */
-    }
+  int i;
+  for (i = 0; i < g->strcachesize * STRCACHE_M; i++) {
+    if (iswhite(g->strcache[i]))  /* will entry be collected? */
+      g->strcache[i] = g->memerrmsg;  /* replace it with something fixed */
+  }
+}
+
+
+/*
+** Give the API string cache 'nsets' sets (a power of 2). The cache does
+** not know the addresses of its entries, so they cannot be moved to the
+** new sets; all entries start with a non-collectable string. Also
+** starts a new window of misses (see 'luaS_new').
+*/
+void luaS_resizecache (lua_State *L, int nsets) {
+  global_State *g = G(L);
+  TString **c;
+  int i;
+  lua_assert((nsets & (nsets - 1)) == 0);
+  c = luaM_newvector(L, nsets * STRCACHE_M, TString *);
+  luaM_freearray(L, g->strcache, g->strcachesize * STRCACHE_M);
+  for (i = 0; i < nsets * STRCACHE_M; i++)
+    c[i] = g->memerrmsg;
+  g->strcache = c;
+  g->strcachesize = nsets;
+  g->strcachewin = nsets * STRCACHE_M;
+  g->strcachemark = g->strcachehits;
 }
 
 
@@ -118,14 +313,11 @@ void luaS_clearcache (global_State *g) {
 */
 void luaS_init (lua_State *L) {
   global_State *g = G(L);
-  int i, j;
   luaS_resize(L, MINSTRTABSIZE);  /* initial size of string table */
   /* pre-create memory-error message */
   g->memerrmsg = luaS_newliteral(L, MEMERRMSG);
   luaC_fix(L, obj2gco(g->memerrmsg));  /* it should never be collected */
-  for (i = 0; i < STRCACHE_N; i++)  /* fill cache with valid strings */
-    for (j = 0; j < STRCACHE_M; j++)
-      g->strcache[i][j] = g->memerrmsg;
+  luaS_resizecache(L, STRCACHE_N);  /* fill cache with valid strings */
 }
 
 
@@ -154,9 +346,163 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 }
 
 
+/*
+** A slice keeps its parent alive, so it is made only when it is long
+** and at least 1/LUAI_SLICERATIO of its parent; a smaller substring is
+** copied, so that it cannot hold much more memory than it uses.
+*/
+#if !defined(LUAI_SLICERATIO)
+#define LUAI_SLICERATIO		16
+#endif
+
+
+/*
+** Create a string with the 'l' bytes of 's' starting at 'i'. A long
+** result may be a slice sharing the bytes of 's' (or of the parent of
+** 's'), which must stay reachable until the result is.
+*/
+TString *luaS_newslice (lua_State *L, TString *s, size_t i, size_t l) {
+  lua_assert(i + l <= tsslen(s));
+#if !defined(LUA_NOSLICES)
+  if (l > G(L)->internlen && s->tt == LUA_TLNGSTR) {
+    TString *parent = s;
+    if (isslice(s) && getslice(s)->parent != NULL)
+      parent = getslice(s)->parent;  /* slices do not nest */
+    if (l >= parent->u.lnglen / LUAI_SLICERATIO) {
+      GCObject *o = luaC_newobj(L, LUA_TLNGSTR, sizeslice);
+      TString *ts = gco2ts(o);
+      StrSlice *sl = getslice(ts);
+      ts->hash = G(L)->seed;
+      ts->extra = STRSLICE;
+      ts->u.lnglen = l;
+      sl->data = getstr(s) + i;
+      sl->parent = parent;
+      return ts;
+    }
+  }
+#endif
+  return luaS_newlstr(L, getstr(s) + i, l);
+}
+
+
+/*
+** Give slice 'ts' a zero-terminated copy of its bytes, letting go of
+** its parent. Needed when it is used as a C string.
+*/
+void luaS_materialize (lua_State *L, TString *ts) {
+  StrSlice *sl = getslice(ts);
+  size_t l = ts->u.lnglen;
+  char *buff;
+  lua_assert(isslice(ts) && sl->parent != NULL);
+  buff = luaM_newvector(L, l + 1, char);
+  memcpy(buff, sl->data, l * sizeof(char));
+  buff[l] = '\0';
+  sl->data = buff;
+  sl->parent = NULL;
+}
+
+
+/*
+** {======================================================
+** Medium strings
+** =======================================================
+*/
+
+/*
+** Tombstone for removed entries in 'medt': any string that is never a
+** medium string (memory-error message is a fixed short string).
+*/
+#define medtomb(g)	((g)->memerrmsg)
+
+
+/*
+** Rebuild the table of medium strings with 'newsize' entries (a power
+** of 2), dropping its tombstones.
+*/
+void luaS_resizemedium (lua_State *L, int newsize) {
+  global_State *g = G(L);
+  medtable *mt = &g->medt;
+  TString **nh = luaM_newvector(L, newsize, TString *);
+  int i;
+  lua_assert(mt->nuse < newsize);
+  for (i = 0; i < newsize; i++)
+    nh[i] = NULL;
+  for (i = 0; i < mt->size; i++) {
+    TString *ts = mt->hash[i];
+    if (ts != NULL && ts != medtomb(g)) {
+      int j = lmod(ts->hash, newsize);
+      while (nh[j] != NULL)
+        j = lmod(j + 1, newsize);
+      nh[j] = ts;
+    }
+  }
+  luaM_freearray(L, mt->hash, mt->size);
+  mt->hash = nh;
+  mt->size = newsize;
+  mt->ndead = 0;
+}
+
+
+static void removemedium (global_State *g, TString *ts) {
+  medtable *mt = &g->medt;
+  int i = lmod(ts->hash, mt->size);
+  while (mt->hash[i] != ts)
+    i = lmod(i + 1, mt->size);
+  mt->hash[i] = medtomb(g);
+  mt->nuse--;
+  mt->ndead++;
+}
+
+
+/*
+** Medium strings are long strings (so, their length is in 'lnglen')
+** interned in 'medt', with their hash computed in advance. Two medium
+** strings are equal only if they are the same object; a long string
+** with the same contents may still exist (e.g., created before the
+** limit changed), which 'luaS_eqlngstr' compares as usual.
+*/
+static TString *internmedstr (lua_State *L, const char *str, size_t l) {
+  global_State *g = G(L);
+  medtable *mt = &g->medt;
+  unsigned int h = luaS_hash(str, l, g->seed);
+  TString *ts;
+  int i;
+  if (mt->nuse + mt->ndead >= mt->size - mt->size / 4) {  /* too full? */
+    int newsize = (mt->size == 0) ? MINMEDTSIZE : mt->size;
+    if (mt->nuse >= newsize / 2)
+      newsize *= 2;  /* else only clean tombstones */
+    luaS_resizemedium(L, newsize);
+  }
+  for (i = lmod(h, mt->size); (ts = mt->hash[i]) != NULL;
+       i = lmod(i + 1, mt->size)) {
+    if (ts != medtomb(g) && ts->hash == h && ts->u.lnglen == l &&
+        memcmp(str, getstr(ts), l * sizeof(char)) == 0) {
+      if (isdead(g, ts))  /* dead (but not collected yet)? */
+        changewhite(ts);  /* resurrect it */
+      return ts;
+    }
+  }
+  /* an emergency collection here only turns entries into tombstones */
+  ts = luaS_createlngstrobj(L, l);
+  memcpy(getstr(ts), str, l * sizeof(char));
+  ts->hash = h;
+  ts->extra = STRINTERNED | 1;  /* hash already computed */
+  mt->hash[i] = ts;
+  mt->nuse++;
+  return ts;
+}
+
+/* }====================================================== */
+
+
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  TString **p;
+  if (ts->tt == LUA_TLNGSTR) {  /* medium string? */
+    removemedium(G(L), ts);
+    return;
+  }
+  p = strbucket(tb, ts->hash);
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
@@ -172,8 +518,11 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   TString *ts;
   global_State *g = G(L);
   unsigned int h = luaS_hash(str, l, g->seed);  // 获取字符串哈希值
-  TString **list = &g->strt.hash[lmod(h, g->strt.size)];
+  TString **list;
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
+  if (g->strt.oldhash != NULL)  /* table growing? */
+    migratestrings(L, &g->strt, STRMIGRATE);
+  list = strbucket(&g->strt, h);
   for (ts = *list; ts != NULL; ts = ts->u.hnext) {
     if (l == ts->shrlen &&
         (memcmp(str, getstr(ts), l * sizeof(char)) == 0)) {
@@ -185,7 +534,7 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   }
   if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2) {
     luaS_resize(L, g->strt.size * 2);
-    list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute with new size */
+    list = strbucket(&g->strt, h);  /* recompute with new size */
   }
   ts = createstrobj(L, l, LUA_TSHRSTR, h);
   memcpy(getstr(ts), str, l * sizeof(char));
@@ -203,6 +552,8 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
 TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
   if (l <= LUAI_MAXSHORTLEN)  /* short string? */
     return internshrstr(L, str, l);
+  else if (l <= G(L)->internlen)  /* medium string? */
+    return internmedstr(L, str, l);
   else {
     TString *ts;
     if (l >= (MAX_SIZE - sizeof(TString))/sizeof(char))
@@ -214,19 +565,108 @@ TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
 }
 
 
+/*
+** Create a string with the 'l' bytes at 's' (followed by a '\0'),
+** which belong to the program. A long string uses them in place and
+** calls 'falloc' to release them when it is collected; a short one is
+** internalized as usual and releases them at once.
+*/
+TString *luaS_newextlstr (lua_State *L, const char *s, size_t l,
+                          lua_Alloc falloc, void *ud) {
+  TString *ts;
+  if (l <= LUAI_MAXSHORTLEN) {
+    ts = internshrstr(L, s, l);
+    if (falloc != NULL)
+      (*falloc)(ud, cast(void *, s), l + 1, 0);
+  }
+  else {
+    GCObject *o = luaC_newobj(L, LUA_TLNGSTR, sizeextstr);
+    ExtString *es;
+    ts = gco2ts(o);
+    es = getextstr(ts);
+    ts->hash = G(L)->seed;
+    ts->extra = STRSLICE | STREXTERNAL;
+    ts->u.lnglen = l;
+    es->sl.data = cast(char *, s);
+    es->sl.parent = NULL;
+    es->falloc = falloc;
+    es->ud = ud;
+  }
+  return ts;
+}
+
+
+/*
+** Create a string with the 'l' bytes at 's' (followed by a '\0'), a
+** block of 'l + 1' bytes from 'luaM_' that the string takes over. A
+** long string keeps it as the copy of a materialized slice, freed
+** with the string; a shorter one is created as usual and the block
+** is freed at once. On a memory error, the block is not taken.
+*/
+TString *luaS_newownedlstr (lua_State *L, char *s, size_t l) {
+  TString *ts;
+  if (l <= G(L)->internlen) {
+    ts = luaS_newlstr(L, s, l);
+    luaM_freearray(L, s, l + 1);
+  }
+  else {
+    GCObject *o = luaC_newobj(L, LUA_TLNGSTR, sizeslice);
+    StrSlice *sl;
+    ts = gco2ts(o);
+    sl = getslice(ts);
+    ts->hash = G(L)->seed;
+    ts->extra = STRSLICE;
+    ts->u.lnglen = l;
+    sl->data = s;
+    sl->parent = NULL;
+  }
+  return ts;
+}
+
+
+/* set of the API string cache for address 'str' */
+#define cacheset(g,str)  \
+	((g)->strcache + lmod(point2uint(str) ^ (point2uint(str) >> 11), \
+	                      (g)->strcachesize) * STRCACHE_M)
+
+
 /*
 ** Create or reuse a zero-terminated string, first checking in the
 ** cache (using the string address as a key). The cache can contain
 ** only zero-terminated strings, so it is safe to use 'strcmp' to
-** check hits.
+** check hits. Each set is kept in LRU order. When a window of misses
+** as long as the cache ends with less than three hits per miss, the
+** number of sets doubles (up to STRCACHE_MAXN).
 */
 TString *luaS_new (lua_State *L, const char *str) {
-  unsigned int i = point2uint(str) % STRCACHE_N;  /* hash */
+  global_State *g = G(L);
+  TString **p = cacheset(g, str);
+  TString *ts;
   int j;
-  TString **p = G(L)->strcache[i];
   for (j = 0; j < STRCACHE_M; j++) {
-    if (strcmp(str, getstr(p[j])) == 0)  /* hit? */
-      return p[j];  /* that is it */
+    if (strcmp(str, getstr(p[j])) == 0) {  /* hit? */
+      ts = p[j];
+      for (; j > 0; j--)
+        p[j] = p[j - 1];  /* move it to the front of its set */
+      p[0] = ts;
+      g->strcachehits++;
+      return ts;  /* that is it */
+    }
+  }
+  g->strcachemisses++;
+  if (--g->strcachewin <= 0) {  /* end of a window? */
+    lu_mem hits = g->strcachehits - g->strcachemark;
+    int nsets = g->strcachesize;
+    if (nsets < STRCACHE_MAXN && hits / 3 < cast(lu_mem, nsets * STRCACHE_M))
+      nsets *= 2;  /* too many misses: grow cache */
+    if (nsets != g->strcachesize) {
+      luaS_resizecache(L, nsets);
+      p = cacheset(g, str);
+    }
+    else {
+      g->strcachewin = nsets * STRCACHE_M;
+      g->strcachemark = g->strcachehits;
+    }
   }
   /* normal route */
   for (j = STRCACHE_M - 1; j > 0; j--)
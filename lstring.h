@@ -14,6 +14,20 @@
 
 #define sizelstring(l)  (sizeof(union UTString) + ((l) + 1) * sizeof(char))  // 字符串结构 + 字符串内容 + \0
 
+#define sizeslice	(sizeof(union UTString) + sizeof(StrSlice))
+#define sizeextstr	(sizeof(union UTString) + sizeof(ExtString))
+
+/* size of the block of long string 'ts' */
+#define sizelngstr(ts)	(!isslice(ts) ? sizelstring((ts)->u.lnglen) : \
+	isexternal(ts) ? sizeextstr : sizeslice)
+
+/*
+** memory used by long string 'ts' (with the copy of a materialized
+** slice; the contents of an external string are not Lua's)
+*/
+#define memlngstr(ts)	(sizelngstr(ts) + ((isslice(ts) && !isexternal(ts) && \
+	getslice(ts)->parent == NULL) ? (ts)->u.lnglen + 1 : 0))
+
 #define sizeludata(l)	(sizeof(union UUdata) + (l))  // 类似于字符串的存储,但是不需要 结尾的 \0
 #define sizeudata(u)	sizeludata((u)->len)
 
@@ -27,6 +41,15 @@
 #define isreserved(s)	((s)->tt == LUA_TSHRSTR && (s)->extra > 0)
 
 
+/*
+** make sure that the contents of string 'ts' are followed by a '\0',
+** as C strings (only a slice may not be)
+*/
+#define luaS_checkcstr(L,ts)  \
+	{ if (isslice(ts) && getstr(ts)[(ts)->u.lnglen] != '\0') \
+	    luaS_materialize(L, ts); }
+
+
 /*
 ** equality for short strings, which are always internalized
 */
@@ -38,12 +61,20 @@ LUAI_FUNC unsigned int luaS_hashlongstr (TString *ts);
 LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
 LUAI_FUNC void luaS_clearcache (global_State *g);
+LUAI_FUNC void luaS_resizecache (lua_State *L, int nsets);
+LUAI_FUNC void luaS_resizemedium (lua_State *L, int newsize);
 LUAI_FUNC void luaS_init (lua_State *L);
 LUAI_FUNC void luaS_remove (lua_State *L, TString *ts);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_new (lua_State *L, const char *str);
 LUAI_FUNC TString *luaS_createlngstrobj (lua_State *L, size_t l);
+LUAI_FUNC TString *luaS_newslice (lua_State *L, TString *s, size_t i,
+                                                            size_t l);
+LUAI_FUNC TString *luaS_newextlstr (lua_State *L, const char *s, size_t l,
+                                    lua_Alloc falloc, void *ud);
+LUAI_FUNC TString *luaS_newownedlstr (lua_State *L, char *s, size_t l);
+LUAI_FUNC void luaS_materialize (lua_State *L, TString *ts);
 
 
 #endif
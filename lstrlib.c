@@ -51,9 +51,24 @@
 
 
 
+/*
+** Get string argument 'arg' like 'luaL_checklstring', but without
+** making a slice get a zero-terminated copy of its own (see
+** 'lua_tobytes'): the bytes are bounded only by '*l'. Patterns and
+** other strings used as C strings still go through
+** 'luaL_checklstring'.
+*/
+static const char *checkbytes (lua_State *L, int arg, size_t *l) {
+  const char *s = lua_tobytes(L, arg, l);
+  if (s == NULL)
+    s = luaL_checklstring(L, arg, l);  /* raise the error */
+  return s;
+}
+
+
 static int str_len (lua_State *L) {
   size_t l;
-  luaL_checklstring(L, 1, &l);
+  checkbytes(L, 1, &l);
   lua_pushinteger(L, (lua_Integer)l);
   return 1;
 }
@@ -69,13 +84,14 @@ static lua_Integer posrelat (lua_Integer pos, size_t len) {
 
 static int str_sub (lua_State *L) {
   size_t l;
-  const char *s = luaL_checklstring(L, 1, &l);
-  lua_Integer start = posrelat(luaL_checkinteger(L, 2), l);
-  lua_Integer end = posrelat(luaL_optinteger(L, 3, -1), l);
+  lua_Integer start, end;
+  checkbytes(L, 1, &l);  /* (converts a number in place) */
+  start = posrelat(luaL_checkinteger(L, 2), l);
+  end = posrelat(luaL_optinteger(L, 3, -1), l);
   if (start < 1) start = 1;
   if (end > (lua_Integer)l) end = l;
   if (start <= end)
-    lua_pushlstring(L, s + start - 1, (size_t)(end - start) + 1);
+    lua_pushsubstring(L, 1, (size_t)start - 1, (size_t)(end - start) + 1);
   else lua_pushliteral(L, "");
   return 1;
 }
@@ -84,7 +100,7 @@ static int str_sub (lua_State *L) {
 static int str_reverse (lua_State *L) {
   size_t l, i;
   luaL_Buffer b;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checkbytes(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
   for (i = 0; i < l; i++)
     p[i] = s[l - i - 1];
@@ -97,7 +113,7 @@ static int str_lower (lua_State *L) {
   size_t l;
   size_t i;
   luaL_Buffer b;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checkbytes(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
   for (i=0; i<l; i++)
     p[i] = tolower(uchar(s[i]));
@@ -110,7 +126,7 @@ static int str_upper (lua_State *L) {
   size_t l;
   size_t i;
   luaL_Buffer b;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checkbytes(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
   for (i=0; i<l; i++)
     p[i] = toupper(uchar(s[i]));
@@ -121,7 +137,7 @@ static int str_upper (lua_State *L) {
 
 static int str_rep (lua_State *L) {
   size_t l, lsep;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checkbytes(L, 1, &l);
   lua_Integer n = luaL_checkinteger(L, 2);
   const char *sep = luaL_optlstring(L, 3, "", &lsep);
   if (n <= 0) lua_pushliteral(L, "");
@@ -147,7 +163,7 @@ static int str_rep (lua_State *L) {
 
 static int str_byte (lua_State *L) {
   size_t l;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checkbytes(L, 1, &l);
   lua_Integer posi = posrelat(luaL_optinteger(L, 2, 1), l);
   lua_Integer pose = posrelat(luaL_optinteger(L, 3, posi), l);
   int n, i;
@@ -216,6 +232,7 @@ typedef struct MatchState {
   const char *src_end;  /* end ('\0') of source string */
   const char *p_end;  /* end ('\0') of pattern */
   lua_State *L;
+  int srcidx;  /* index of source string (captures are substrings of it) */
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   unsigned char level;  /* total number of captures (finished or unfinished) */
   struct {
@@ -547,25 +564,42 @@ static const char *lmemfind (const char *s1, size_t l1,
 }
 
 
-static void push_onecapture (MatchState *ms, int i, const char *s,
-                                                    const char *e) {
+/*
+** get information about the i-th capture: its start in '*cap' and its
+** length (or CAP_POSITION).
+*/
+static ptrdiff_t get_onecapture (MatchState *ms, int i, const char *s,
+                                 const char *e, const char **cap) {
   if (i >= ms->level) {
-    if (i == 0)  /* ms->level == 0, too */
-      lua_pushlstring(ms->L, s, e - s);  /* add whole match */
-    else
+    if (i != 0)
       luaL_error(ms->L, "invalid capture index %%%d", i + 1);
+    *cap = s;  /* ms->level == 0: whole match */
+    return e - s;
   }
   else {
     ptrdiff_t l = ms->capture[i].len;
     if (l == CAP_UNFINISHED) luaL_error(ms->L, "unfinished capture");
-    if (l == CAP_POSITION)
-      lua_pushinteger(ms->L, (ms->capture[i].init - ms->src_init) + 1);
-    else
-      lua_pushlstring(ms->L, ms->capture[i].init, l);
+    *cap = ms->capture[i].init;
+    return l;
   }
 }
 
 
+/*
+** push the i-th capture, as a substring of the source (which may share
+** its memory, see 'lua_pushsubstring')
+*/
+static void push_onecapture (MatchState *ms, int i, const char *s,
+                                                    const char *e) {
+  const char *cap;
+  ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
+  if (l == CAP_POSITION)
+    lua_pushinteger(ms->L, (cap - ms->src_init) + 1);
+  else
+    lua_pushsubstring(ms->L, ms->srcidx, cap - ms->src_init, l);
+}
+
+
 static int push_captures (MatchState *ms, const char *s, const char *e) {
   int i;
   int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
@@ -588,9 +622,10 @@ static int nospecials (const char *p, size_t l) {
 }
 
 
-static void prepstate (MatchState *ms, lua_State *L,
+static void prepstate (MatchState *ms, lua_State *L, int srcidx,
                        const char *s, size_t ls, const char *p, size_t lp) {
   ms->L = L;
+  ms->srcidx = srcidx;
   ms->matchdepth = MAXCCALLS;
   ms->src_init = s;
   ms->src_end = s + ls;
@@ -598,6 +633,20 @@ static void prepstate (MatchState *ms, lua_State *L,
 }
 
 
+/*
+** Lua code run by 'gsub' (a function or table replacement) or between
+** calls to a 'gmatch' iterator may use the subject as a C string,
+** moving the bytes of a slice to a copy of its own. Point 'ms' at the
+** current bytes and return how far they moved.
+*/
+static ptrdiff_t rebase (MatchState *ms) {
+  ptrdiff_t d = lua_tobytes(ms->L, ms->srcidx, NULL) - ms->src_init;
+  ms->src_init += d;
+  ms->src_end += d;
+  return d;
+}
+
+
 static void reprepstate (MatchState *ms) {
   ms->level = 0;
   lua_assert(ms->matchdepth == MAXCCALLS);
@@ -606,7 +655,7 @@ static void reprepstate (MatchState *ms) {
 
 static int str_find_aux (lua_State *L, int find) {
   size_t ls, lp;
-  const char *s = luaL_checklstring(L, 1, &ls);
+  const char *s = checkbytes(L, 1, &ls);
   const char *p = luaL_checklstring(L, 2, &lp);
   lua_Integer init = posrelat(luaL_optinteger(L, 3, 1), ls);
   if (init < 1) init = 1;
@@ -631,7 +680,7 @@ static int str_find_aux (lua_State *L, int find) {
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
-    prepstate(&ms, L, s, ls, p, lp);
+    prepstate(&ms, L, 1, s, ls, p, lp);
     do {
       const char *res;
       reprepstate(&ms);
@@ -673,7 +722,12 @@ typedef struct GMatchState {
 static int gmatch_aux (lua_State *L) {
   GMatchState *gm = (GMatchState *)lua_touserdata(L, lua_upvalueindex(3));
   const char *src;
+  ptrdiff_t d;
   gm->ms.L = L;
+  d = rebase(&gm->ms);
+  gm->src += d;
+  if (gm->lastmatch != NULL)
+    gm->lastmatch += d;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
     reprepstate(&gm->ms);
@@ -688,12 +742,12 @@ static int gmatch_aux (lua_State *L) {
 
 static int gmatch (lua_State *L) {
   size_t ls, lp;
-  const char *s = luaL_checklstring(L, 1, &ls);
+  const char *s = checkbytes(L, 1, &ls);
   const char *p = luaL_checklstring(L, 2, &lp);
   GMatchState *gm;
   lua_settop(L, 2);  /* keep them on closure to avoid being collected */
   gm = (GMatchState *)lua_newuserdata(L, sizeof(GMatchState));
-  prepstate(&gm->ms, L, s, ls, p, lp);
+  prepstate(&gm->ms, L, lua_upvalueindex(1), s, ls, p, lp);
   gm->src = s; gm->p = p; gm->lastmatch = NULL;
   lua_pushcclosure(L, gmatch_aux, 3);
   return 1;
@@ -717,11 +771,17 @@ static void add_s (MatchState *ms, luaL_Buffer *b, const char *s,
       }
       else if (news[i] == '0')
           luaL_addlstring(b, s, e - s);
-      else {
-        push_onecapture(ms, news[i] - '1', s, e);
-        luaL_tolstring(L, -1, NULL);  /* if number, convert it to string */
-        lua_remove(L, -2);  /* remove original value */
-        luaL_addvalue(b);  /* add capture to accumulated result */
+      else {  /* add capture directly, without making it a string */
+        const char *cap;
+        ptrdiff_t resl = get_onecapture(ms, news[i] - '1', s, e, &cap);
+        if (resl == CAP_POSITION) {
+          lua_pushinteger(L, (cap - ms->src_init) + 1);
+          luaL_tolstring(L, -1, NULL);  /* convert it to string */
+          lua_remove(L, -2);  /* remove original value */
+          luaL_addvalue(b);  /* add position to accumulated result */
+        }
+        else
+          luaL_addlstring(b, cap, resl);
       }
     }
   }
@@ -731,6 +791,7 @@ static void add_s (MatchState *ms, luaL_Buffer *b, const char *s,
 static void add_value (MatchState *ms, luaL_Buffer *b, const char *s,
                                        const char *e, int tr) {
   lua_State *L = ms->L;
+  size_t l = e - s;
   switch (tr) {
     case LUA_TFUNCTION: {
       int n;
@@ -749,9 +810,10 @@ static void add_value (MatchState *ms, luaL_Buffer *b, const char *s,
       return;
     }
   }
+  s += rebase(ms);  /* the subject may have moved */
   if (!lua_toboolean(L, -1)) {  /* nil or false? */
     lua_pop(L, 1);
-    lua_pushlstring(L, s, e - s);  /* keep original text */
+    lua_pushlstring(L, s, l);  /* keep original text */
   }
   else if (!lua_isstring(L, -1))
     luaL_error(L, "invalid replacement value (a %s)", luaL_typename(L, -1));
@@ -761,7 +823,7 @@ static void add_value (MatchState *ms, luaL_Buffer *b, const char *s,
 
 static int str_gsub (lua_State *L) {
   size_t srcl, lp;
-  const char *src = luaL_checklstring(L, 1, &srcl);  /* subject */
+  const char *src = checkbytes(L, 1, &srcl);  /* subject */
   const char *p = luaL_checklstring(L, 2, &lp);  /* pattern */
   const char *lastmatch = NULL;  /* end of last match */
   int tr = lua_type(L, 3);  /* replacement type */
@@ -777,14 +839,15 @@ static int str_gsub (lua_State *L) {
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
-  prepstate(&ms, L, src, srcl, p, lp);
+  prepstate(&ms, L, 1, src, srcl, p, lp);
   while (n < max_s) {
     const char *e;
     reprepstate(&ms);  /* (re)prepare state for new match */
     if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+      size_t pos = e - ms.src_init;
       n++;
       add_value(&ms, &b, src, e, tr);  /* add replacement to buffer */
-      src = lastmatch = e;
+      src = lastmatch = ms.src_init + pos;  /* (subject may have moved) */
     }
     else if (src < ms.src_end)  /* otherwise, skip one character */
       luaL_addchar(&b, *src++);
@@ -1039,6 +1102,11 @@ static int str_format (lua_State *L) {
           break;
         }
         case 'd': case 'i':
+          if (form[2] == '\0' && lua_isinteger(L, arg)) {  /* plain '%d'? */
+            nb = (int)lua_numbertocstring(L, arg, buff) - 1;
+            break;
+          }
+          /* FALLTHROUGH */
         case 'o': case 'u': case 'x': case 'X': {
           lua_Integer n = luaL_checkinteger(L, arg);
           addlenmod(form, LUA_INTEGER_FRMLEN);
@@ -1063,7 +1131,16 @@ static int str_format (lua_State *L) {
         }
         case 's': {
           size_t l;
-          const char *s = luaL_tolstring(L, arg, &l);
+          const char *s;
+          if (form[2] == '\0' && lua_type(L, arg) == LUA_TNUMBER) {
+            if (luaL_getmetafield(L, arg, "__tostring") == LUA_TNIL) {
+              /* plain number: write it without making a string */
+              nb = (int)lua_numbertocstring(L, arg, buff) - 1;
+              break;
+            }
+            lua_pop(L, 1);  /* remove metamethod; 'luaL_tolstring' calls it */
+          }
+          s = luaL_tolstring(L, arg, &l);
           if (form[2] == '\0')  /* no modifiers? */
             luaL_addvalue(&b);  /* keep entire string */
           else {
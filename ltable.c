@@ -74,10 +74,16 @@
 
 #define dummynode		(&dummynode_)
 
+#if defined(LUA_COMPACTNODES)
+static const Node dummynode_ = {
+  {NILCONSTANT, LUA_TNIL, 0, {NULL}}  /* value, key type, next, key value */
+};
+#else
 static const Node dummynode_ = {
   {NILCONSTANT},  /* value */
   {{NILCONSTANT, 0}}  /* key */
 };
+#endif
 
 
 /*
@@ -143,18 +149,58 @@ static Node *mainposition (const Table *t, const TValue *key) {
 }
 
 
+/*
+** returns the main position of the key stored in node 'nd'
+*/
+static Node *mainpositionfromnode (const Table *t, Node *nd) {
+  TValue key;
+  getnodekey(cast(lua_State *, NULL), &key, nd);
+  return mainposition(t, &key);
+}
+
+
+/*
+** Check whether key 'k1' is equal to the key in node 'n2'. A dead key
+** matches a collectable key with the same object only if 'deadok' is
+** true (which is needed by 'next', as the key may have been collected
+** during the traversal). Keys are normalized, so an integer never
+** equals a float here.
+*/
+static int equalkey (const TValue *k1, const Node *n2, int deadok) {
+  if (rttype(k1) != keytt(n2))  /* not the same variants? */
+    return (deadok && keyisdead(n2) && iscollectable(k1) &&
+            gcvalue(k1) == gckey(n2));
+  switch (ttype(k1)) {
+    case LUA_TNIL:
+      return 1;
+    case LUA_TNUMINT:
+      return (ivalue(k1) == keyival(n2));
+    case LUA_TNUMFLT:
+      return luai_numeq(fltvalue(k1), keyval(n2).n);
+    case LUA_TBOOLEAN:
+      return (bvalue(k1) == keyval(n2).b);
+    case LUA_TLIGHTUSERDATA:
+      return (pvalue(k1) == keyval(n2).p);
+    case LUA_TLCF:
+      return (fvalue(k1) == keyval(n2).f);
+    case LUA_TLNGSTR:
+      return luaS_eqlngstr(tsvalue(k1), keystrval(n2));
+    default:
+      return (gcvalue(k1) == gckey(n2));
+  }
+}
+
+
 /*
 适当的
-** returns the index for 'key' if 'key' is an appropriate key to live in
+** returns the index for 'k' if 'k' is an appropriate key to live in
 ** the array part of the table, 0 otherwise.
 */
-static unsigned int arrayindex (const TValue *key) {
-  if (ttisinteger(key)) {
-    lua_Integer k = ivalue(key);  // 获取整数的值
-    if (0 < k && (lua_Unsigned)k <= MAXASIZE)
-      return cast(unsigned int, k);  /* 'key' is an appropriate array index */
-  }
-  return 0;  /* 'key' did not match some condition */
+static unsigned int arrayindex (lua_Integer k) {
+  if (0 < k && (lua_Unsigned)k <= MAXASIZE)
+    return cast(unsigned int, k);  /* 'key' is an appropriate array index */
+  else
+    return 0;  /* 'key' did not match some condition */
 }
 
 
@@ -168,7 +214,7 @@ traversals 遍历
 static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   unsigned int i;
   if (ttisnil(key)) return 0;  /* first iteration */ // 第一个迭代时,key为nil,返回0,遍历第一额元素
-  i = arrayindex(key);  // key 必须是一个整数,然后将其转换为 unint ,并返回;否则,返回0
+  i = ttisinteger(key) ? arrayindex(ivalue(key)) : 0;  // key 必须是一个整数,然后将其转换为 unint ,并返回;否则,返回0
   if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */   // key 不等于0 并且小于数组的大小,在数组部分,
     return i;  /* yes; that's the index */
   else {  // 否则就是在哈希表部分
@@ -176,9 +222,7 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
     Node *n = mainposition(t, key);  // 获取key的主要位置. 如果主要位置上不是
     for (;;) {  /* check whether 'key' is somewhere in the chain */
       /* key may be dead already, but it is ok to use it in 'next' */
-      if (luaV_rawequalobj(gkey(n), key) ||     // 当前节点的key跟要查询的key是不是一样, 变量活着的时候
-            (ttisdeadkey(gkey(n)) && iscollectable(key) &&  // 变量死了的时候的判定方法
-             deadvalue(gkey(n)) == gcvalue(key))) {     // 找到这个节点了.
+      if (equalkey(key, n, 1)) {  // 当前节点的key跟要查询的key是不是一样(key 可能已经死了)
         i = cast_int(n - gnode(t, 0));  /* key index in hash table */  // 获取要查询的key对应的节点在哈希表中的索引,通过位置偏移获取索引
         /* hash elements are numbered after array ones */ // 散列元素 在数组元素之后编号
         return (i + 1) + t->sizearray;  // 返回的索引是相对数组部分的索引. 从这里可以看出来,哈希表是紧跟在数组后面的.  
@@ -191,28 +235,75 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   }
 }
 
-// 传入上一个key,返回下一个键值对
+/*
+** Put in 'res' and 'res + 1' the first entry of table 't' stored after
+** traversal index 'i' and return its own traversal index (which is
+** always positive), or return 0 if there are no more elements.
+*/
 // #TODO 既然i已经是找到的索引了,这里这里为什么要用循环呢? 因为这个函数是要找到给定key的下一个非空值,所以要遍历,直到找到一个非空的,
-int luaH_next (lua_State *L, Table *t, StkId key) {
-  unsigned int i = findindex(L, t, key);  /* find original element */     // 返回的索引是相对table  数组部分的索引, 如果key为空,就返回0,这里正好对应如果next的key为空,就返回第一个元素.因为0后面的元素就是1
+static unsigned int nextfrom (lua_State *L, Table *t, unsigned int i,
+                                                      StkId res) {
   for (; i < t->sizearray; i++) {  /* try first array part */ // 先从数组里面找  这里直接返回了索引
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */  // 如果key不为空, 哈哈哈哈哈  pairs ipair 都是复用的next,next是调用了 luaH_next,luaH_next是根据value的值是不是空来判断这个键值对是否存在的.不是根据key,所以在table中,只要把value置为nil,就遍历不到了
-      setivalue(key, i + 1);
-      setobj2s(L, key+1, &t->array[i]);
-      return 1;
+      setivalue(res, i + 1);
+      setobj2s(L, res+1, &t->array[i]);
+      return i + 1;
     }
   }
   for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) {  /* hash part */  // 再从哈希表里找
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
-      setobj2s(L, key, gkey(gnode(t, i)));
-      setobj2s(L, key+1, gval(gnode(t, i)));
-      return 1;
+      getnodekey(L, res, gnode(t, i));
+      setobj2s(L, res+1, gval(gnode(t, i)));
+      return (i + 1) + t->sizearray;
     }
   }
   return 0;  /* no more elements */
 }
 
 
+// 传入上一个key,返回下一个键值对
+int luaH_next (lua_State *L, Table *t, StkId key) {
+  unsigned int i = findindex(L, t, key);  /* find original element */     // 返回的索引是相对table  数组部分的索引, 如果key为空,就返回0,这里正好对应如果next的key为空,就返回第一个元素.因为0后面的元素就是1
+  return (nextfrom(L, t, i, key) != 0);
+}
+
+
+/*
+** Check whether traversal index 'i' of table 't' still holds 'key'.
+*/
+static int slotholds (Table *t, lua_Integer i, const TValue *key) {
+  if (l_castS2U(i) - 1 < t->sizearray)  /* array part? */
+    return (ttisinteger(key) && ivalue(key) == i);
+  else if (l_castS2U(i) - 1 - t->sizearray < cast(lua_Unsigned, sizenode(t)))
+    return equalkey(key, gnode(t, i - 1 - t->sizearray), 1);
+  else return 0;
+}
+
+
+/*
+** Traversal step for generic 'for' loops over the primitive 'next'.
+** 'slot' keeps the traversal index where 'key' was found in the
+** previous step; if that slot still holds 'key', the traversal resumes
+** from there without searching for the key again (otherwise it falls
+** back to 'findindex'). The next entry goes to 'res' and 'res + 1' and
+** its index to 'slot'.
+*/
+int luaH_nextslot (lua_State *L, Table *t, StkId key, StkId slot,
+                                                      StkId res) {
+  unsigned int i;
+  if (ttisnil(key))
+    i = 0;  /* first iteration */
+  else if (ttisinteger(slot) && slotholds(t, ivalue(slot), key))
+    i = cast(unsigned int, ivalue(slot));
+  else
+    i = findindex(L, t, key);
+  i = nextfrom(L, t, i, res);
+  if (i == 0) return 0;  /* no more elements */
+  setivalue(slot, i);
+  return 1;
+}
+
+
 /*
 ** {=============================================================
 ** Rehash
@@ -250,7 +341,7 @@ static unsigned int computesizes (unsigned int nums[], unsigned int *pna) {
 }
 
 
-static int countint (const TValue *key, unsigned int *nums) {
+static int countint (lua_Integer key, unsigned int *nums) {
   unsigned int k = arrayindex(key);
   if (k != 0) {  /* is 'key' an appropriate array index? */
     nums[luaO_ceillog2(k)]++;  /* count as such */
@@ -299,7 +390,8 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
   while (i--) {
     Node *n = &t->node[i];
     if (!ttisnil(gval(n))) {
-      ause += countint(gkey(n), nums);
+      if (keyisinteger(n))
+        ause += countint(keyival(n), nums);
       totaluse++;
     }
   }
@@ -315,6 +407,25 @@ static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
      setnilvalue(&t->array[i]);
   t->sizearray = size;
 }
+
+
+/*
+** Empty all nodes of the (non-dummy) hash part of 't' in place and
+** mark all of them as free again, keeping the allocated vector.
+*/
+static void clearnodevector (Table *t) {
+  int i;
+  int size = sizenode(t);
+  for (i = 0; i < size; i++) {
+    Node *n = gnode(t, i);
+    gnext(n) = 0;
+    setnilkey(n);
+    setnilvalue(gval(n));
+  }
+  t->lastfree = gnode(t, size);  /* all positions are free */ // 最后一个可用的node, 在lastfree之后的node都是不可用的.
+}
+
+
 /*
 哈希表的最小尺寸为 2 的 0 次幂， 也就是 1 。 为了减少空表的维护 成本， lua 在这里做了一点优化。 
 它定义了一个不可改写的空哈希表： dummynode 。 让空表被初始化时， Node 域指向这个 dummynode 节点。 
@@ -328,20 +439,13 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
     t->lastfree = NULL;  /* signal that it is using dummy node */
   }
   else {
-    int i;
     int lsize = luaO_ceillog2(size);
     if (lsize > MAXHBITS)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
     t->node = luaM_newvector(L, size, Node);  // 申请大小为 size 的 Node 类型的数组
-    for (i = 0; i < (int)size; i++) {
-      Node *n = gnode(t, i);
-      gnext(n) = 0;   // 将每个node 的 next 设置为0
-      setnilvalue(wgkey(n));  // 将key 和value都设置nil
-      setnilvalue(gval(n));
-    }
     t->lsizenode = cast_byte(lsize);
-    t->lastfree = gnode(t, size);  /* all positions are free */ // 最后一个可用的node, 在lastfree之后的node都是不可用的.
+    clearnodevector(t);  // 将每个node 的 next 设置为0, key 和value都设置nil
   }
 }
 
@@ -394,7 +498,9 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
     if (!ttisnil(gval(old))) {
       /* doesn't need barrier/invalidate cache, as entry was
          already present in the table */
-      setobjt2t(L, luaH_set(L, t, gkey(old)), gval(old));
+      TValue k;
+      getnodekey(L, &k, old);
+      setobjt2t(L, luaH_set(L, t, &k), gval(old));
     }
   }
   if (oldhsize > 0)  /* not the dummy node? */
@@ -407,6 +513,20 @@ void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
   luaH_resize(L, t, nasize, nsize);
 }
 
+
+/*
+** Remove all entries from table 't' without changing the sizes of its
+** array and hash parts, so that it can be refilled without rehashing.
+** (Removing entries needs no barrier.)
+*/
+void luaH_clear (Table *t) {
+  unsigned int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (!isdummy(t))
+    clearnodevector(t);
+}
+
 /*
 ** nums[i] = number of keys 'k' where 2^(i - 1) < k <= 2^i
 */
@@ -421,7 +541,8 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   totaluse = na;  /* all those keys are integer keys */
   totaluse += numusehash(t, nums, &na);  /* count keys in hash part */
   /* count extra key */
-  na += countint(ek, nums);
+  if (ttisinteger(ek))
+    na += countint(ivalue(ek), nums);
   totaluse++;
   /* compute new size for array part */
   asize = computesizes(nums, &na);  // computesizes函数计算出不低于50%利用率下，数组该维持多少空间。同时，还可以得到有多少有效键将被储存在哈希表里。
@@ -452,7 +573,7 @@ void luaH_free (lua_State *L, Table *t) {
   if (!isdummy(t))  // 如果有必要释放 node节点
     luaM_freearray(L, t->node, cast(size_t, sizenode(t)));  // 释放node节点 
   luaM_freearray(L, t->array, t->sizearray);
-  luaM_free(L, t);
+  luaM_freefixed(L, t);
 }
 
 // 从哈希表的后往前遍历找一个key为nil的node并返回
@@ -460,7 +581,7 @@ static Node *getfreepos (Table *t) {
   if (!isdummy(t)) {
     while (t->lastfree > t->node) {
       t->lastfree--;
-      if (ttisnil(gkey(t->lastfree)))
+      if (keyisnil(t->lastfree))
         return t->lastfree;
     }
   }
@@ -511,7 +632,7 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
       return luaH_set(L, t, key);  /* insert key into grown table */
     }
     lua_assert(!isdummy(t));
-    othern = mainposition(t, gkey(mp));
+    othern = mainpositionfromnode(t, mp);
     if (othern != mp) {  /* is colliding node out of its main position? */
       /* yes; move colliding node into free position */
       while (othern + gnext(othern) != mp)  /* find previous */
@@ -533,7 +654,7 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
       mp = f;
     }
   }
-  setnodekey(L, &mp->i_key, key);
+  setnodekey(L, mp, key);
   luaC_barrierback(L, t, key);
   lua_assert(ttisnil(gval(mp)));
   return gval(mp);
@@ -550,7 +671,7 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
   else {
     Node *n = hashint(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
-      if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
+      if (keyisinteger(n) && keyival(n) == key)
         return gval(n);  /* that's it */
       else {
         int nx = gnext(n);
@@ -570,8 +691,7 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
   Node *n = hashstr(t, key);  // 短字符串的哈希值在table 哈希表部分对应的值
   lua_assert(key->tt == LUA_TSHRSTR);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
-    const TValue *k = gkey(n);
-    if (ttisshrstring(k) && eqshrstr(tsvalue(k), key))
+    if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);  // 如果当前位置不是该短字符串,去链表里面寻找
@@ -590,7 +710,30 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 static const TValue *getgeneric (Table *t, const TValue *key) {
   Node *n = mainposition(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
-    if (luaV_rawequalobj(gkey(n), key))
+    if (equalkey(key, n, 0))
+      return gval(n);  /* that's it */
+    else {
+      int nx = gnext(n);
+      if (nx == 0)
+        return luaO_nilobject;  /* not found */
+      n += nx;
+    }
+  }
+}
+
+
+/*
+** search function for medium strings: like short strings, they are
+** found by identity, but the table may have an equal long string that
+** is not interned (see 'internmedstr').
+*/
+static const TValue *getmedstr (Table *t, TString *key) {
+  Node *n = hashstr(t, key);
+  lua_assert(key->tt == LUA_TLNGSTR && isinterned(key));
+  for (;;) {  /* check whether 'key' is somewhere in the chain */
+    if (keyislngstr(n) &&
+        (keystrval(n) == key ||
+         (!isinterned(keystrval(n)) && luaS_eqlngstr(keystrval(n), key))))
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);
@@ -605,6 +748,8 @@ static const TValue *getgeneric (Table *t, const TValue *key) {
 const TValue *luaH_getstr (Table *t, TString *key) {
   if (key->tt == LUA_TSHRSTR)
     return luaH_getshortstr(t, key);
+  else if (isinterned(key))
+    return getmedstr(t, key);
   else {  /* for long strings, use generic case */
     TValue ko;
     setsvalue(cast(lua_State *, NULL), &ko, key);
@@ -620,6 +765,11 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 const TValue *luaH_get (Table *t, const TValue *key) {
   switch (ttype(key)) {
     case LUA_TSHRSTR: return luaH_getshortstr(t, tsvalue(key));
+    case LUA_TLNGSTR: {
+      if (isinterned(tsvalue(key)))
+        return getmedstr(t, tsvalue(key));
+      return getgeneric(t, key);
+    }
     case LUA_TNUMINT: return luaH_getint(t, ivalue(key));
     case LUA_TNIL: return luaO_nilobject;
     case LUA_TNUMFLT: {
@@ -12,19 +12,18 @@
 
 #define gnode(t,i)	(&(t)->node[i])
 #define gval(n)		(&(n)->i_val)    // get value of node
+#if defined(LUA_COMPACTNODES)
+#define gnext(n)	((n)->u.next)
+#else
 #define gnext(n)	((n)->i_key.nk.next)
+#endif
 
+#define invalidateTMcache(t)	((t)->flags = 0)
 
-/* 'const' to avoid wrong writings that can mess up field 'next' */
-#define gkey(n)		cast(const TValue*, (&(n)->i_key.tvk))
-
-/*
-** writable version of 'gkey'; allows updates to individual fields,
-** but not to the whole (which has incompatible type)
-*/
-#define wgkey(n)		(&(n)->i_key.nk)
 
-#define invalidateTMcache(t)	((t)->flags = 0)
+/* raise an error if table 't' is frozen (see 'luaC_freeze') */
+#define luaH_checkfrozen(L,t) \
+  { if (isfrozen(t)) luaG_runerror(L, "attempt to modify a frozen table"); }
 
 
 /* true when 't' is using 'dummynode' as its hash part */
@@ -35,9 +34,9 @@
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
-/* returns the key, given the value of a table entry */
-#define keyfromval(v) \
-  (gkey(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
+/* returns the node, given the value of a table entry */
+#define nodefromval(v) \
+  cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))
 
 
 LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
@@ -52,8 +51,11 @@ LUAI_FUNC Table *luaH_new (lua_State *L);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
+LUAI_FUNC void luaH_clear (Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC int luaH_nextslot (lua_State *L, Table *t, StkId key, StkId slot,
+                                                            StkId res);
 LUAI_FUNC lua_Unsigned luaH_getn (Table *t);
 
 
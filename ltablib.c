@@ -76,6 +76,51 @@ static int maxn (lua_State *L) {
 #endif
 
 
+/*
+** table.new(narr, nrec): create a table with preallocated space for
+** 'narr' array elements and 'nrec' other elements
+*/
+static int tnew (lua_State *L) {
+  lua_Integer narr = luaL_optinteger(L, 1, 0);
+  lua_Integer nrec = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, 0 <= narr && narr <= INT_MAX, 1, "out of range");
+  luaL_argcheck(L, 0 <= nrec && nrec <= INT_MAX, 2, "out of range");
+  lua_createtable(L, (int)narr, (int)nrec);
+  return 1;
+}
+
+
+/*
+** table.clear(t): remove all elements from 't', keeping its allocated
+** space for reuse
+*/
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+
+/*
+** table.freeze(t): make 't' and every table reachable from it immutable
+** and permanent; returns 't'
+*/
+static int tfreeze (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  if (!lua_freezetable(L, 1))
+    return luaL_error(L, "table contains values that cannot be frozen");
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int tisfrozen (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_pushboolean(L, lua_isfrozen(L, 1));
+  return 1;
+}
+
+
 static int tinsert (lua_State *L) {
   lua_Integer e = aux_getn(L, 1, TAB_RW) + 1;  /* first empty element */
   lua_Integer pos;  /* where to insert new element */
@@ -91,6 +136,9 @@ static int tinsert (lua_State *L) {
       for (i = e; i > pos; i--) {  /* move up elements */
         lua_geti(L, 1, i - 1);
         lua_seti(L, 1, i);  /* t[i] = t[i - 1] */
+        /* after growing the table, move the others in one go */
+        if (i == e && lua_arraymove(L, 1, pos, e - 2, pos + 1, 1))
+          break;
       }
       break;
     }
@@ -109,6 +157,8 @@ static int tremove (lua_State *L) {
   if (pos != size)  /* validate 'pos' if given */
     luaL_argcheck(L, 1 <= pos && pos <= size + 1, 1, "position out of bounds");
   lua_geti(L, 1, pos);  /* result = t[pos] */
+  if (pos < size && lua_arraymove(L, 1, pos + 1, size, pos, 1))
+    pos = size;  /* moved all elements in one go */
   for ( ; pos < size; pos++) {
     lua_geti(L, 1, pos + 1);
     lua_seti(L, 1, pos);  /* t[pos] = t[pos + 1] */
@@ -139,7 +189,9 @@ static int tmove (lua_State *L) {
     n = e - f + 1;  /* number of elements to move */
     luaL_argcheck(L, t <= LUA_MAXINTEGER - n + 1, 4,
                   "destination wrap around");
-    if (t > e || t <= f || (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
+    if (lua_arraymove(L, 1, f, e, t, tt))
+      ;  /* moved all elements in one go */
+    else if (t > e || t <= f || (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
       for (i = 0; i < n; i++) {
         lua_geti(L, 1, f + i);
         lua_seti(L, tt, t + i);
@@ -434,6 +486,10 @@ static const luaL_Reg tab_funcs[] = {
   {"remove", tremove},
   {"move", tmove},
   {"sort", sort},
+  {"new", tnew},
+  {"clear", tclear},
+  {"freeze", tfreeze},
+  {"isfrozen", tisfrozen},
   {NULL, NULL}
 };
 
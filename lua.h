@@ -79,10 +79,15 @@ typedef struct lua_State lua_State;
 #define LUA_MINSTACK	20
 
 
+/* minimum size of the buffer for 'lua_numbertocstring' */
+#define LUA_N2SBUFFSZ	64
+
+
 /* predefined values in the registry */
 #define LUA_RIDX_MAINTHREAD	1
 #define LUA_RIDX_GLOBALS	2
-#define LUA_RIDX_LAST		LUA_RIDX_GLOBALS
+#define LUA_RIDX_KEYS		3
+#define LUA_RIDX_LAST		LUA_RIDX_KEYS
 
 
 /* type of numbers in Lua */
@@ -125,6 +130,12 @@ typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
 
+/*
+** Handle of a pre-interned string key (see 'lua_internkey')
+*/
+typedef const struct lua_KeyS *lua_Key;
+
+
 
 /*
 ** generic extra include file
@@ -148,6 +159,7 @@ LUA_API void       (lua_close) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
 
 LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
+LUA_API lua_CFunction (lua_setnextfunc) (lua_State *L, lua_CFunction nextf);
 
 
 LUA_API const lua_Number *(lua_version) (lua_State *L);
@@ -189,6 +201,14 @@ LUA_API void	       *(lua_touserdata) (lua_State *L, int idx);
 LUA_API lua_State      *(lua_tothread) (lua_State *L, int idx);
 LUA_API const void     *(lua_topointer) (lua_State *L, int idx);
 
+/*
+** Like 'lua_tolstring', but the bytes of a string may not be followed
+** by a '\0' (so a slice is not given a copy of its own). The pointer is
+** valid while the string is on the stack; numbers are converted in
+** place, as 'lua_tolstring' does.
+*/
+LUA_API const char     *(lua_tobytes) (lua_State *L, int idx, size_t *len);
+
 
 /*
 ** Comparison and arithmetic functions
@@ -226,7 +246,13 @@ LUA_API void        (lua_pushnil) (lua_State *L);
 LUA_API void        (lua_pushnumber) (lua_State *L, lua_Number n);
 LUA_API void        (lua_pushinteger) (lua_State *L, lua_Integer n);
 LUA_API const char *(lua_pushlstring) (lua_State *L, const char *s, size_t len);
+LUA_API void        (lua_pushsubstring) (lua_State *L, int idx, size_t i,
+                                                     size_t len);
+LUA_API const char *(lua_pushexternalstring) (lua_State *L, const char *s,
+                                 size_t len, lua_Alloc falloc, void *ud);
 LUA_API const char *(lua_pushstring) (lua_State *L, const char *s);
+LUA_API lua_Key     (lua_internkey) (lua_State *L, const char *s);
+LUA_API void        (lua_pushkey) (lua_State *L, lua_Key k);
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
 LUA_API const char *(lua_pushfstring) (lua_State *L, const char *fmt, ...);
@@ -235,6 +261,15 @@ LUA_API void  (lua_pushboolean) (lua_State *L, int b);
 LUA_API void  (lua_pushlightuserdata) (lua_State *L, void *p);
 LUA_API int   (lua_pushthread) (lua_State *L);
 
+/*
+** Push a string that takes over block 's', which must come from
+** 'lua_realloc' with 'len + 1' bytes and have s[len] == '\0'. A long
+** string keeps the block (no copy); a shorter one is copied and the
+** block freed at once. Returns the string contents. If it raises a
+** memory error, the block is not taken and the caller still owns it.
+*/
+LUA_API const char *(lua_pushownedstring) (lua_State *L, char *s, size_t len);
+
 
 /*
 ** get functions (Lua -> stack)
@@ -242,6 +277,7 @@ LUA_API int   (lua_pushthread) (lua_State *L);
 LUA_API int (lua_getglobal) (lua_State *L, const char *name);
 LUA_API int (lua_gettable) (lua_State *L, int idx);
 LUA_API int (lua_getfield) (lua_State *L, int idx, const char *k);
+LUA_API int (lua_getkey) (lua_State *L, int idx, lua_Key k);
 LUA_API int (lua_geti) (lua_State *L, int idx, lua_Integer n);
 LUA_API int (lua_rawget) (lua_State *L, int idx);
 LUA_API int (lua_rawgeti) (lua_State *L, int idx, lua_Integer n);
@@ -259,6 +295,7 @@ LUA_API int  (lua_getuservalue) (lua_State *L, int idx);
 LUA_API void  (lua_setglobal) (lua_State *L, const char *name);
 LUA_API void  (lua_settable) (lua_State *L, int idx);
 LUA_API void  (lua_setfield) (lua_State *L, int idx, const char *k);
+LUA_API void  (lua_setkey) (lua_State *L, int idx, lua_Key k);
 LUA_API void  (lua_seti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, lua_Integer n);
@@ -282,6 +319,7 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                           const char *chunkname, const char *mode);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
+LUA_API int (lua_heapdump) (lua_State *L, lua_Writer writer, void *data);
 
 
 /*
@@ -309,10 +347,110 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
 #define LUA_GCISRUNNING		9
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
+#define LUA_GCWORKERS		12
+#define LUA_GCSWEEPER		13
+#define LUA_GCSETMAXPAUSE	14
+#define LUA_GCSETOVERHEAD	15
+#define LUA_GCPACERMUL		16
+#define LUA_GCSOFTLIMIT		17
+#define LUA_GCHARDLIMIT		18
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** garbage-collection statistics
+*/
+
+/* collector phases (in the order of a cycle, ending with the pause) */
+#define LUA_GCPPROPAGATE	0
+#define LUA_GCPATOMIC		1
+#define LUA_GCPSWPALLGC		2
+#define LUA_GCPSWPFINOBJ	3
+#define LUA_GCPSWPTOBEFNZ	4
+#define LUA_GCPSWPEND		5
+#define LUA_GCPCALLFIN		6
+#define LUA_GCPPAUSE		7
+
+#define LUA_GCNPHASES		8
+
+/* type index of function prototypes in 'marked' and 'freed' */
+#define LUA_GCTPROTO		LUA_NUMTAGS
+
+/* times are in microseconds; other entries count objects or bytes */
+typedef struct lua_GCStats {
+  size_t cycles;  /* cycles completed since the state was created */
+  size_t steps;  /* steps (or whole collections) in this cycle */
+  size_t maxstep;  /* duration of the longest step */
+  size_t time[LUA_GCNPHASES];  /* time in each phase (finalizers apart) */
+  size_t finalizers;  /* time running finalizers */
+  size_t marked[LUA_NUMTAGS + 1];  /* objects marked, by type */
+  size_t freed[LUA_NUMTAGS + 1];  /* objects freed, by type */
+  size_t freedbytes;  /* memory given back */
+} lua_GCStats;
+
+/*
+** Called when the collector moves from one phase to another (a cycle in
+** generational mode goes from LUA_GCPCALLFIN back to LUA_GCPPROPAGATE).
+** It must not call the API, except for 'lua_gcstats'.
+*/
+typedef void (*lua_GCHook) (lua_State *L, int from, int to, void *ud);
+
+LUA_API void (lua_gcstats) (lua_State *L, lua_GCStats *stats);
+LUA_API lua_GCHook (lua_getgchook) (lua_State *L, void **ud);
+LUA_API void (lua_setgchook) (lua_State *L, lua_GCHook f, void *ud);
+
+
+/*
+** memory limits (set with LUA_GCSOFTLIMIT and LUA_GCHARDLIMIT)
+*/
+
+#define LUA_MEMSOFT	0
+#define LUA_MEMHARD	1
+
+/*
+** Called from inside the allocator when the memory in use would cross
+** the soft limit, or when even an emergency collection could not keep
+** it under the hard limit. It returns the new value for that limit (in
+** bytes; 0 removes it) and must not call the API.
+*/
+typedef size_t (*lua_MemHook) (lua_State *L, int what, size_t inuse,
+                               size_t limit, void *ud);
+
+LUA_API lua_MemHook (lua_getmemhook) (lua_State *L, void **ud);
+LUA_API void (lua_setmemhook) (lua_State *L, lua_MemHook f, void *ud);
+
+
+/*
+** Cache of strings pushed by address ('lua_pushstring', 'lua_getfield',
+** etc.): 'lua_strcache' gives the numbers of lookups that hit and that
+** missed (if 'hits'/'misses' are not NULL) and returns the number of
+** sets of the cache; if 'nsets' > 0, the cache is first rebuilt with
+** that many sets (rounded up to a power of 2).
+*/
+LUA_API int (lua_strcache) (lua_State *L, int nsets, size_t *hits,
+                                                     size_t *misses);
+
+/*
+** Strings up to 'len' bytes are interned, so that comparing or looking
+** up equal strings only compares pointers. Lengths up to LUAI_MAXSHORTLEN
+** (the default) intern only short strings; lengths above
+** LUAI_MAXINTERNLEN are cut to it. Returns the previous limit; a
+** negative 'len' only queries it.
+*/
+LUA_API int (lua_internlen) (lua_State *L, int len);
+
+/*
+** Strings order by 'strcoll' (the default) or, when 'bytes' is true, by
+** their bytes, which is what 'strcoll' does in the "C" locale, without
+** its cost. Returns the previous mode; a negative 'bytes' only queries
+** it. (See 'luaL_setcollate'.)
+*/
+LUA_API int (lua_bytecollate) (lua_State *L, int bytes);
+
+
 /*
 ** miscellaneous functions
 */
@@ -320,15 +458,40 @@ LUA_API int (lua_gc) (lua_State *L, int what, int data);
 LUA_API int   (lua_error) (lua_State *L);
 
 LUA_API int   (lua_next) (lua_State *L, int idx);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
+
+/*
+** Make the table at 'idx' and everything reachable from it immutable
+** and exempt from collection, for the life of this state. Returns 0
+** (changing nothing) if the graph has something that cannot be
+** frozen. Frozen objects still belong to this state: they cannot be
+** shared with other states.
+*/
+LUA_API int   (lua_freezetable) (lua_State *L, int idx);
+LUA_API int   (lua_isfrozen) (lua_State *L, int idx);
+
+LUA_API int   (lua_arraymove) (lua_State *L, int a1, lua_Integer f,
+                               lua_Integer e, lua_Integer t, int a2);
 
 LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API void  (lua_len)    (lua_State *L, int idx);
 
 LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
+LUA_API unsigned (lua_numbertocstring) (lua_State *L, int idx, char *buff);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
 
+/*
+** Allocate ('block' NULL), resize or free ('nsize' 0) a block through
+** the state's allocator, as the core does: the memory counts for the
+** collector, the memory limits and the allocation profiler, and a
+** failure raises a memory error instead of returning NULL. 'osize'
+** must be the size the block was allocated with.
+*/
+LUA_API void     *(lua_realloc) (lua_State *L, void *block, size_t osize,
+                                 size_t nsize);
+
 
 
 /*
@@ -438,6 +601,13 @@ LUA_API lua_Hook (lua_gethook) (lua_State *L);
 LUA_API int (lua_gethookmask) (lua_State *L);
 LUA_API int (lua_gethookcount) (lua_State *L);
 
+/* allocation profiler */
+typedef void (*lua_AllocSite) (lua_State *L, const char *stack, size_t bytes,
+                               size_t samples, void *ud);
+
+LUA_API size_t (lua_allocprofile) (lua_State *L, size_t interval);
+LUA_API void (lua_allocsites) (lua_State *L, lua_AllocSite f, void *ud);
+
 
 struct lua_Debug {
   int event;
@@ -82,6 +82,58 @@
 #endif
 
 
+/*
+@@ LUA_COMPACTNODES packs the nodes of table hash parts: the key tag
+** and the chain offset go in the padding after the value, so that a
+** node takes 24 bytes instead of 32 on 64-bit machines. (Value tags
+** are then stored in a single byte.)
+*/
+/* #define LUA_COMPACTNODES */
+
+
+/*
+@@ LUA_USE_PARALLELGC lets the collector use worker threads to mark
+** objects in its atomic phase (see option LUA_GCWORKERS in 'lua_gc')
+** and a thread to give back the memory of dead objects (LUA_GCSWEEPER).
+** It needs POSIX threads (-lpthread) and GCC-style atomic builtins.
+** With LUA_USE_SLABS, small objects are freed into their slabs by the
+** collector itself; the sweeper thread gets only larger blocks.
+*/
+/* #define LUA_USE_PARALLELGC */
+
+
+/*
+@@ LUA_USE_SLABS makes small objects of fixed size (tables, closures,
+** short strings, upvalues, etc.) come from per-state slabs instead of
+** directly from the allocation function. Slabs make allocation
+** cheaper, but each size class in use holds at least one slab (16KB),
+** and a slab goes back to the allocator only when all its blocks are
+** free: a heap where a few objects survive among many dead ones keeps
+** much more memory. Memory checkers cannot see use-after-free errors
+** inside slabs.
+*/
+/* #define LUA_USE_SLABS */
+
+
+/*
+@@ LUA_NOSLICES makes 'string.sub' and pattern captures always copy
+** their results. By default, long substrings of long strings share
+** the memory of the original string (see 'luaS_newslice').
+*/
+/* #define LUA_NOSLICES */
+
+
+/*
+@@ LUA_WORDHASH hashes strings 8 bytes at a time over their whole
+** length, in the style of xxHash64. The default hash reads one byte at
+** a time and, for strings longer than 32 bytes, only some of them; so
+** long keys differing only in unread bytes always collide.
+@@ luai_hashstring(s,l,seed), if defined, replaces both as the hash of
+** the 'l' bytes at 's'. It must return an 'unsigned int'.
+*/
+/* #define LUA_WORDHASH */
+
+
 
 /*
 @@ LUAI_BITSINT defines the (minimum) number of bits in an 'int'.
@@ -402,6 +454,16 @@
 */
 /* #define LUA_COMPAT_FLOATSTRING */
 
+
+/*
+@@ LUA_COMPAT_NUMFORMAT makes Lua convert floats to strings with
+** LUA_NUMBER_FMT, as it used to. By default, a double is written with
+** (nearly always) the fewest digits that convert back to the same
+** value, so that 0.1 + 0.2 shows as 0.30000000000000004, not as 0.3;
+** numbers of 1e16 or more use scientific notation.
+*/
+/* #define LUA_COMPAT_NUMFORMAT */
+
 /* }================================================================== */
 
 
@@ -91,8 +91,8 @@ static TString *LoadString (LoadState *S) {
     LoadVar(S, size);
   if (size == 0)
     return NULL;
-  else if (--size <= LUAI_MAXSHORTLEN) {  /* short string? */
-    char buff[LUAI_MAXSHORTLEN];
+  else if (--size <= G(S->L)->internlen) {  /* short (or medium) string? */
+    char buff[LUAI_MAXINTERNLEN];
     LoadVector(S, buff, size);
     return luaS_newlstr(S->L, buff, size);
   }
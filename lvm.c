@@ -65,6 +65,17 @@
 
 
 
+/*
+** Convert string 'obj' to a number in 'v'. The conversion is bounded
+** by the length of the string, so a slice (which may lack a final
+** '\0') is copied only when its numeral needs 'lua_str2number'.
+*/
+static int l_strton (const TValue *obj, TValue *v) {
+  TString *ts = tsvalue(obj);
+  return luaO_str2numl(getstr(ts), tsslen(ts), v);
+}
+
+
 /*
 ** Try to convert a value to a float. The float case is already handled
 ** by the macro 'tonumber'.
@@ -76,7 +87,7 @@ int luaV_tonumber_ (const TValue *obj, lua_Number *n) {
     return 1;
   }
   else if (cvt2num(obj) &&  /* string convertible to number? */
-            luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
+            l_strton(obj, &v)) {
     *n = nvalue(&v);  /* convert result of 'luaO_str2num' to a float */
     return 1;
   }
@@ -108,8 +119,7 @@ int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode) {
     *p = ivalue(obj);
     return 1;
   }
-  else if (cvt2num(obj) &&
-            luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
+  else if (cvt2num(obj) && l_strton(obj, &v)) {
     obj = &v;
     goto again;  /* convert result from 'luaO_str2num' to an integer */
   }
@@ -197,8 +207,8 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
 ** Finish a table assignment 't[key] = val'.
 ** If 'slot' is NULL, 't' is not a table.  Otherwise, 'slot' points
 ** to the entry 't[key]', or to 'luaO_nilobject' if there is no such
-** entry.  (The value at 'slot' must be nil, otherwise 'luaV_fastset'
-** would have done the job.)
+** entry.  (The value at 'slot' must be nil or the table must be frozen,
+** otherwise 'luaV_fastset' would have done the job.)
 */
 void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                      StkId val, const TValue *slot) {
@@ -207,6 +217,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
     const TValue *tm;  /* '__newindex' metamethod */
     if (slot != NULL) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
+      luaH_checkfrozen(L, h);
       lua_assert(ttisnil(slot));  /* old value must be nil */
       tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
       if (tm == NULL) {  /* no metamethod? */
@@ -241,15 +252,27 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 /*
 ** Compare two strings 'ls' x 'rs', returning an integer smaller-equal-
 ** -larger than zero if 'ls' is smaller-equal-larger than 'rs'.
-** The code is a little tricky because it allows '\0' in the strings
-** and it uses 'strcoll' (to respect locales) for each segments
-** of the strings.
+** In the "C" locale ('bytecollate'), that is a comparison of bytes,
+** done by 'memcmp'. Otherwise, the code is a little tricky because it
+** allows '\0' in the strings and it uses 'strcoll' (to respect locales)
+** for each segments of the strings. (So slices need their own
+** zero-terminated copies.)
 */
-static int l_strcmp (const TString *ls, const TString *rs) {
-  const char *l = getstr(ls);
+static int l_strcmp (lua_State *L, TString *ls, TString *rs) {
+  const char *l, *r;
   size_t ll = tsslen(ls);
-  const char *r = getstr(rs);
   size_t lr = tsslen(rs);
+  if (G(L)->bytecollate) {
+    int temp = memcmp(getstr(ls), getstr(rs), (ll < lr) ? ll : lr);
+    if (temp != 0)  /* not equal? */
+      return temp;  /* done */
+    else  /* one is a prefix of the other; shorter is smaller */
+      return (ll < lr) ? -1 : (ll > lr);
+  }
+  luaS_checkcstr(L, ls);
+  luaS_checkcstr(L, rs);
+  l = getstr(ls);
+  r = getstr(rs);
   for (;;) {  /* for each segment */
     int temp = strcoll(l, r);
     if (temp != 0)  /* not equal? */
@@ -366,7 +389,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
     return LTnum(l, r);
   else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) < 0;
   else if ((res = luaT_callorderTM(L, l, r, TM_LT)) < 0)  /* no metamethod? */
     luaG_ordererror(L, l, r);  /* error */
   return res;
@@ -386,7 +409,7 @@ int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
     return LEnum(l, r);
   else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) <= 0;
   else if ((res = luaT_callorderTM(L, l, r, TM_LE)) >= 0)  /* try 'le' */
     return res;
   else {  /* try 'lt': */
@@ -494,8 +517,8 @@ void luaV_concat (lua_State *L, int total) {
           luaG_runerror(L, "string length overflow");
         tl += l;
       }
-      if (tl <= LUAI_MAXSHORTLEN) {  /* is result a short string? */
-        char buff[LUAI_MAXSHORTLEN];
+      if (tl <= G(L)->internlen) {  /* is result a short (or medium) string? */
+        char buff[LUAI_MAXINTERNLEN];
         copy2buff(top, n, buff);  /* copy strings to buffer */
         ts = luaS_newlstr(L, buff, tl);
       }
@@ -1241,13 +1264,28 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_TFORCALL) {
-        StkId cb = ra + 3;  /* call base */
-        setobjs2s(L, cb+2, ra+2);
-        setobjs2s(L, cb+1, ra+1);
-        setobjs2s(L, cb, ra);
-        L->top = cb + 3;  /* func. + 2 args (state and index) */
-        Protect(luaD_call(L, cb, GETARG_C(i)));
-        L->top = ci->top;
+        StkId cb = ra + 4;  /* call base */
+        if (ttislcf(ra) && fvalue(ra) == G(L)->nextf && ttistable(ra + 1) &&
+            !(L->hookmask & (LUA_MASKCALL | LUA_MASKRET))) {
+          /* primitive 'next' over a table: step through slot indices */
+          int n;
+          if (luaH_nextslot(L, hvalue(ra + 1), ra + 2, ra + 3, cb))
+            n = 2;  /* got key and value */
+          else {
+            setnilvalue(cb);  /* end of traversal */
+            n = 1;
+          }
+          for (; n < GETARG_C(i); n++)  /* complete missing results */
+            setnilvalue(cb + n);
+        }
+        else {
+          setobjs2s(L, cb+2, ra+2);
+          setobjs2s(L, cb+1, ra+1);
+          setobjs2s(L, cb, ra);
+          L->top = cb + 3;  /* func. + 2 args (state and index) */
+          Protect(luaD_call(L, cb, GETARG_C(i)));
+          L->top = ci->top;
+        }
         i = *(ci->u.l.savedpc++);  /* go to next instruction */
         ra = RA(i);
         lua_assert(GET_OPCODE(i) == OP_TFORLOOP);
@@ -1255,8 +1293,8 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_TFORLOOP) {
         l_tforloop:
-        if (!ttisnil(ra + 1)) {  /* continue loop? */
-          setobjs2s(L, ra, ra + 1);  /* save control variable */
+        if (!ttisnil(ra + 2)) {  /* continue loop? */
+          setobjs2s(L, ra, ra + 2);  /* save control variable */
            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
         }
         vmbreak;
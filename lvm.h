@@ -71,10 +71,11 @@
 
 
 /*
-** Fast track for set table. If 't' is a table and 't[k]' is not nil,
-** call GC barrier, do a raw 't[k]=v', and return true; otherwise,
-** return false with 'slot' equal to NULL (if 't' is not a table) or
-** 'nil'. (This is needed by 'luaV_finishget'.) Note that, if the macro
+** Fast track for set table. If 't' is a table that is not frozen and
+** 't[k]' is not nil, call GC barrier, do a raw 't[k]=v', and return
+** true; otherwise, return false with 'slot' equal to NULL (if 't' is
+** not a table) or to the entry. (This is needed by 'luaV_finishget'.)
+** Note that, if the macro
 ** returns true, there is no need to 'invalidateTMcache', because the
 ** call is not creating a new entry.
 */
@@ -82,7 +83,7 @@
   (!ttistable(t) \
    ? (slot = NULL, 0) \
    : (slot = f(hvalue(t), k), \
-     ttisnil(slot) ? 0 \
+     (ttisnil(slot) || isfrozen(hvalue(t))) ? 0 \
      : (luaC_barrierback(L, hvalue(t), v), \
         setobj2t(L, cast(TValue *,slot), v), \
         1)))